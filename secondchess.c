@@ -17,13 +17,20 @@ along with this program. If not, see <http://www.gnu.org/licenses/>
  * BASIC PARTS: *
  * Some definitions *
  * Board representation and main varians *
+ * Bitboards *
+ * Hashing *
  * Move generator *
  * Evaluation for current position *
  * Make and Take back a move *
  * IsInCheck *
  * IsAttacked *
+ * Transposition table *
+ * Engine state *
+ * Time management *
  * Search function - a typical alphabeta *
  * Quiescent search
+ * Threads *
+ * Engine API *
  * Utilities *
  * Main program *
  */
@@ -32,11 +39,31 @@ along with this program. If not, see <http://www.gnu.org/licenses/>
 #include <time.h>
 #include <stdlib.h>
 #include <locale.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
+#include "secondchess.h"
 
 
 //#define NDEBUG
 #include <assert.h>
 
+/* Uncomment to check after every MakeMove and TakeBack that the hash
+ * key is the same as the one calculated from scratch. It's slow! */
+//#define DEBUG_HASH
+
+/* Uncomment to check after every MakeMove and TakeBack that the score of
+ * the position is the same as the one calculated from scratch. Slow too */
+//#define DEBUG_EVAL
+
+/* Uncomment to count the calls to the hot functions and print them after
+ * each search, see Profiling. With PROFILE_CYCLES we also time them with
+ * the cycle counter of the cpu (only x86). Without PROFILE none of it is
+ * compiled, so it costs nothing */
+//#define PROFILE
+//#define PROFILE_CYCLES
+
 /*
  ****************************************************************************
  * Some definitions *
@@ -48,7 +75,6 @@ along with this program. If not, see <http://www.gnu.org/licenses/>
 #define ROOK 3
 #define QUEEN 4
 #define KING 5
-#define EPS_SQUARE 6
 #define EMPTY 7
 #define WHITE 0
 #define BLACK 1
@@ -63,10 +89,26 @@ along with this program. If not, see <http://www.gnu.org/licenses/>
 #define VALUE_KING 10000
 
 #define MATE 10000		/* equal value of King, losing King==mate */
+#define MAX_PLY 128		/* Scores beyond MATE - MAX_PLY are mates */
+#define MAX_DEPTH 64		/* Max depth of the iterative deepening */
+#define MAX_THREADS 256
+#define MAX_MOVES 256		/* A position has 218 moves at most */
 
 #define COL(pos) ((pos)&7)
 #define ROW(pos) (((unsigned)pos)>>3)
 
+/* A bitboard is a set of squares, one bit for each square: bit 0 is A8
+ * and bit 63 is H1, the same numbering we use for the board */
+typedef unsigned long long BITBOARD;
+
+#define BIT(sq) (1ULL << (sq))
+#define LSB(bb) __builtin_ctzll(bb)	/* First square in the set */
+#define MSB(bb) (63 - __builtin_clzll(bb))	/* Last square in the set */
+#define POPCOUNT(bb) __builtin_popcountll(bb)	/* Number of squares in the set */
+
+/* A 64 bits number which identifies a position, see Hashing */
+typedef unsigned long long HASHKEY;
+
 /* For move generation */
 #define MOVE_TYPE_NONE 0
 #define MOVE_TYPE_NORMAL 1
@@ -101,10 +143,6 @@ along with this program. If not, see <http://www.gnu.org/licenses/>
  * Board representation and main variants *
  ****************************************************************************
  */
-/* Board representation */
-int piece[64];
-int color[64];
-
 /* Piece in each square */
 int init_piece[64] = {
   ROOK, KNIGHT, BISHOP, QUEEN, KING, BISHOP, KNIGHT, ROOK,
@@ -150,30 +188,31 @@ int init_color[64] = {
 //        EMPTY, EMPTY, EMPTY, EMPTY, WHITE, EMPTY, EMPTY, WHITE };
 
 
-int side;			/* Side to move, value = BLACK or WHITE */
 int computer_side;
 int max_depth;			/* max depth to search */
 
-/* A move is defined by its origin and final squares, the castle rights and the kind of
- * move it's: normal, enpasant... */
-typedef struct tag_MOVE
-{
-  int from;
-  int dest;
-//      int castle;
-  int type;
-} MOVE;
+/* A move is defined by its origin and final squares and the kind of
+ * move it's: normal, enpasant... All of it is packed in 16 bits, from in
+ * bits 0-5, dest in bits 6-11 and type in bits 12-15, so the move lists
+ * are small and we can store a move in the hash table just as it is */
+typedef unsigned short MOVE;
+
+#define MOVE_FROM(m) ((m) & 63)
+#define MOVE_DEST(m) (((m) >> 6) & 63)
+#define MOVE_TYPE(m) ((m) >> 12)
+#define NEW_MOVE(f, d, t) ((MOVE) ((f) | ((d) << 6) | ((t) << 12)))
+#define NO_MOVE 0		/* Its type is MOVE_TYPE_NONE */
 
 /* For storing all moves of game */
 typedef struct tag_HIST
 {
+  HASHKEY hash;
   MOVE m;
-  int castle;
-  int cap;
+  unsigned char castle;
+  unsigned char cap;
+  signed char eps;
 } HIST;
 
-HIST hist[6000];		/* Game length < 6000 */
-
 /* For castle rights we use a bitfield, like in TSCP
  *
  * 0001 -> White can short castle
@@ -184,8 +223,6 @@ HIST hist[6000];		/* Game length < 6000 */
  * 15 = 1111 = 1*2^3 + 1*2^2 + 1*2^1 + 1*2^0
  *
  */
-int castle_rights = 15;		/* At start position all castle types ar available */
-
 
 /* This mask is applied like this
  *
@@ -212,17 +249,88 @@ int castle_mask[64] = {
   13, 15, 15, 15, 12, 15, 15, 14
 };
 
-int hdp;			/* Current move order */
-//int allmoves = 0;
-
-/* For searching */
-int nodes;			/* Count all visited nodes when searching */
-int ply;			/* ply of search */
-int count_evaluations;
-int count_checks;
-int count_MakeMove;
-int count_quies_calls;
-int count_cap_calls;
+/* * * * * * * * * * * * *
+ * Profiling
+ * * * * * * * * * * * * */
+/* The functions we count. Each position has its own counters, as each
+ * thread has its own position, so the threads don't fight for them, and
+ * ComputerThink adds them up at the end of the search */
+#define PROF_GENMOVES 0
+#define PROF_GENCAPS 1
+#define PROF_GENQUIETS 2
+#define PROF_EVAL 3
+#define PROF_MAKEMOVE 4
+#define PROF_TAKEBACK 5
+#define PROF_ISATTACKED 6
+#define PROF_QUIESCENT 7		/* Just the calls, it's recursive */
+#define PROF_FUNCTIONS 8
+
+#ifdef PROFILE
+typedef struct tag_PROFDATA
+{
+  unsigned long long calls[PROF_FUNCTIONS];
+  unsigned long long cycles[PROF_FUNCTIONS];	/* Including the functions it calls */
+} PROFDATA;
+
+/* PROF_ENTER goes after the declarations of the function, and PROF_LEAVE
+ * just before it returns */
+#ifdef PROFILE_CYCLES
+#if !defined(__GNUC__) || !(defined(__x86_64__) || defined(__i386__))
+#error "PROFILE_CYCLES needs gcc and an x86 cpu"
+#endif
+#define PROF_ENTER(pos) unsigned long long prof_start = __builtin_ia32_rdtsc ()
+#define PROF_LEAVE(pos, f) ((pos)->prof.calls[f]++, \
+  (pos)->prof.cycles[f] += __builtin_ia32_rdtsc () - prof_start)
+#else
+#define PROF_ENTER(pos)
+#define PROF_LEAVE(pos, f) ((pos)->prof.calls[f]++)
+#endif
+#define PROF_COUNT(pos, f) ((pos)->prof.calls[f]++)
+
+#else
+#define PROF_ENTER(pos)
+#define PROF_LEAVE(pos, f)
+#define PROF_COUNT(pos, f)
+#endif
+
+/* A position: the board, whose turn it is, the castle rights, the eps
+ * square and the moves that led to it. There are no global boards, every
+ * function is given the position it works on, so we can have as many of
+ * them as we want: one for each search thread, one for each game... */
+typedef struct tag_POSITION
+{
+  /* Board representation. The piece and color arrays tell what is in a
+   * given square, while the bitboards tell where the pieces of a given kind
+   * are, so we don't need to scan the whole board looking for them */
+  int piece[64];
+  int color[64];
+  BITBOARD bb_piece[2][6];	/* The squares of the pieces of each color and kind */
+  BITBOARD bb_color[2];		/* The squares of all the pieces of each color */
+  BITBOARD bb_all;		/* All the occupied squares */
+  int king_sq[2];		/* Where the kings are */
+
+  int side;			/* Side to move, value = BLACK or WHITE */
+  int castle_rights;		/* At start position all castle types ar available */
+
+  /* The square a pawn has just jumped over when moving two squares, where
+   * it can be captured en passant. -1 if there isn't any */
+  int eps_square;
+
+  HASHKEY hash_key;		/* The key of the position, see Hashing */
+  HASHKEY pawn_key;		/* The same, but just with the pawns */
+  int score_mg;			/* Material and piece squares, see Eval */
+  int score_eg;
+  int phase;			/* 24 with all the pieces, 0 with just pawns */
+
+  int hdp;			/* Current move order */
+  int ply;			/* ply of search */
+
+#ifdef PROFILE
+  PROFDATA prof;			/* The calls to the hot functions, see Profiling */
+#endif
+
+  HIST hist[6000];		/* Game length < 6000, keep it the last one */
+} POSITION;
 
 /* The values of the pieces in centipawns */
 int value_piece[6] =
@@ -235,7 +343,10 @@ VALUE_KING };
 /* When evaluating the position we'll add a bonus (or malus) to each piece
  * depending on the very square where it's placed. Vg, a knight in d4 will
  * be given an extra +15, whilst a knight in a1 will be penalized with -40.
- * This simple idea allows the engine to make more sensible moves */
+ * This simple idea allows the engine to make more sensible moves.
+ * The best square for a piece isn't the same in the middlegame as in the
+ * endgame, so each piece has two tables, and the score goes from one to the
+ * other as the pieces leave the board, see Eval */
 int pst_pawn[64] = {
   0, 0, 0, 0, 0, 0, 0, 0,
   0, 0, 0, 0, 0, 0, 0, 0,
@@ -280,6 +391,17 @@ int pst_rook[64] = {
   0, 0, 0, 5, 5, 0, 0, 0
 };
 
+int pst_queen[64] = {
+  -10, -5, -5, -5, -5, -5, -5, -10,
+  -5, 0, 0, 0, 0, 0, 0, -5,
+  -5, 0, 0, 0, 0, 0, 0, -5,
+  -5, 0, 0, 0, 0, 0, 0, -5,
+  -5, 0, 0, 0, 0, 0, 0, -5,
+  -5, 0, 5, 5, 5, 5, 0, -5,
+  -5, 0, 0, 5, 5, 0, 0, -5,
+  -10, -5, -5, 0, 0, -5, -5, -10
+};
+
 int pst_king[64] = {
   -25, -25, -25, -25, -25, -25, -25, -25,
   -25, -25, -25, -25, -25, -25, -25, -25,
@@ -291,6 +413,80 @@ int pst_king[64] = {
   10, 15, -15, -15, -15, -15, 15, 10
 };
 
+/* In the endgame the pawns are worth more the closer they are to promote */
+int pst_pawn_eg[64] = {
+  0, 0, 0, 0, 0, 0, 0, 0,
+  60, 60, 60, 60, 60, 60, 60, 60,
+  35, 35, 35, 35, 35, 35, 35, 35,
+  20, 20, 20, 20, 20, 20, 20, 20,
+  10, 10, 10, 10, 10, 10, 10, 10,
+  0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0
+};
+
+int pst_knight_eg[64] = {
+  -40, -30, -20, -20, -20, -20, -30, -40,
+  -30, -10, 0, 0, 0, 0, -10, -30,
+  -20, 0, 10, 10, 10, 10, 0, -20,
+  -20, 0, 10, 15, 15, 10, 0, -20,
+  -20, 0, 10, 15, 15, 10, 0, -20,
+  -20, 0, 10, 10, 10, 10, 0, -20,
+  -30, -10, 0, 0, 0, 0, -10, -30,
+  -40, -30, -20, -20, -20, -20, -30, -40
+};
+
+int pst_bishop_eg[64] = {
+  -15, -10, -10, -10, -10, -10, -10, -15,
+  -10, 0, 0, 0, 0, 0, 0, -10,
+  -10, 0, 5, 5, 5, 5, 0, -10,
+  -10, 0, 5, 10, 10, 5, 0, -10,
+  -10, 0, 5, 10, 10, 5, 0, -10,
+  -10, 0, 5, 5, 5, 5, 0, -10,
+  -10, 0, 0, 0, 0, 0, 0, -10,
+  -15, -10, -10, -10, -10, -10, -10, -15
+};
+
+int pst_rook_eg[64] = {
+  5, 5, 5, 5, 5, 5, 5, 5,
+  10, 10, 10, 10, 10, 10, 10, 10,
+  0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0
+};
+
+int pst_queen_eg[64] = {
+  -20, -10, -10, -5, -5, -10, -10, -20,
+  -10, 0, 0, 0, 0, 0, 0, -10,
+  -10, 0, 5, 5, 5, 5, 0, -10,
+  -5, 0, 5, 10, 10, 5, 0, -5,
+  -5, 0, 5, 10, 10, 5, 0, -5,
+  -10, 0, 5, 5, 5, 5, 0, -10,
+  -10, 0, 0, 0, 0, 0, 0, -10,
+  -20, -10, -10, -5, -5, -10, -10, -20
+};
+
+/* With few pieces left the king is safe, and it must go to the center to
+ * help its pawns and stop the enemy ones */
+int pst_king_eg[64] = {
+  -50, -30, -30, -30, -30, -30, -30, -50,
+  -30, -10, 0, 0, 0, 0, -10, -30,
+  -30, 0, 20, 25, 25, 20, 0, -30,
+  -30, 0, 25, 30, 30, 25, 0, -30,
+  -30, 0, 25, 30, 30, 25, 0, -30,
+  -30, 0, 20, 25, 25, 20, 0, -30,
+  -30, -10, 0, 0, 0, 0, -10, -30,
+  -50, -30, -30, -30, -30, -30, -30, -50
+};
+
+/* How much each piece counts for the game phase. At the start there are
+ * 4 minor pieces, 4 rooks and 2 queens: 4 + 8 + 8 = 24 */
+#define PHASE_MAX 24
+int phase_piece[6] = { 0, 1, 1, 2, 4, 0 };
+
 /* The flip array is used to calculate the piece/square
 values for BLACKS pieces, without needing to write the
 arrays for them (idea taken from TSCP).
@@ -307,20 +503,455 @@ int flip[64] = {
   0, 1, 2, 3, 4, 5, 6, 7
 };
 
+int *pst_mg[6] =
+  { pst_pawn, pst_knight, pst_bishop, pst_rook, pst_queen, pst_king };
+int *pst_eg[6] = { pst_pawn_eg, pst_knight_eg, pst_bishop_eg, pst_rook_eg,
+  pst_queen_eg, pst_king_eg
+};
+
+/* The material and the piece square value of each piece in each square,
+ * together in one number from white's point of view, so the black pieces
+ * are negative. The position keeps the sum of them up to date while the
+ * pieces come and go, see AddPiece, and Eval just has to read it */
+int piece_square_mg[2][6][64];
+int piece_square_eg[2][6][64];
+
+/* For the pawn structure: the squares of each file and of the files next
+ * to it, the squares a pawn has to pass by with no enemy pawns there to be
+ * a passed pawn, and the squares where a friendly pawn can defend it now or
+ * after advancing, so it isn't backward */
+BITBOARD file_mask[8];
+BITBOARD adjacent_files[8];
+BITBOARD passed_mask[2][64];
+BITBOARD support_mask[2][64];
+
+/* Fill in the evaluation tables. Call it once before anything else */
+void
+InitEval ()
+{
+  int p;
+  int sq;
+  int sq2;
+
+  for (p = PAWN; p <= KING; p++)
+    for (sq = 0; sq < 64; sq++)
+      {
+	piece_square_mg[WHITE][p][sq] = value_piece[p] + pst_mg[p][sq];
+	piece_square_mg[BLACK][p][flip[sq]] = -piece_square_mg[WHITE][p][sq];
+	piece_square_eg[WHITE][p][sq] = value_piece[p] + pst_eg[p][sq];
+	piece_square_eg[BLACK][p][flip[sq]] = -piece_square_eg[WHITE][p][sq];
+      }
+
+  for (sq = 0; sq < 64; sq++)
+    file_mask[COL (sq)] |= BIT (sq);
+  for (sq = 0; sq < 8; sq++)
+    adjacent_files[sq] = (sq > 0 ? file_mask[sq - 1] : 0) |
+      (sq < 7 ? file_mask[sq + 1] : 0);
+
+  /* White pawns go to row 0 and black ones to row 7 */
+  for (sq = 0; sq < 64; sq++)
+    for (sq2 = 0; sq2 < 64; sq2++)
+      {
+	if (abs (COL (sq2) - COL (sq)) > 1)
+	  continue;
+	if (ROW (sq2) < ROW (sq))
+	  passed_mask[WHITE][sq] |= BIT (sq2);
+	if (ROW (sq2) > ROW (sq))
+	  passed_mask[BLACK][sq] |= BIT (sq2);
+	if (COL (sq2) == COL (sq))
+	  continue;
+	if (ROW (sq2) >= ROW (sq))
+	  support_mask[WHITE][sq] |= BIT (sq2);
+	if (ROW (sq2) <= ROW (sq))
+	  support_mask[BLACK][sq] |= BIT (sq2);
+      }
+}
+
+/*
+ ****************************************************************************
+ * Bitboards *
+ ****************************************************************************
+ */
+/* The squares attacked by a knight, a king and a pawn of each color
+ * placed in a given square */
+BITBOARD knight_attacks[64];
+BITBOARD king_attacks[64];
+BITBOARD pawn_attacks[2][64];
+
+/* The squares a slider sees in each direction from a given square
+ * when the board is empty */
+#define NORTH 0
+#define SOUTH 1
+#define EAST 2
+#define WEST 3
+#define NORTH_EAST 4
+#define NORTH_WEST 5
+#define SOUTH_EAST 6
+#define SOUTH_WEST 7
+BITBOARD rays[8][64];
+BITBOARD bishop_rays[64];	/* The four diagonal rays together */
+BITBOARD rook_rays[64];		/* The ranks and files rays together */
+int ray_col_step[8] = { 0, 0, 1, -1, 1, -1, 1, -1 };
+int ray_row_step[8] = { -1, 1, 0, 0, -1, -1, 1, 1 };
+
+/* For two squares in the same rank, file or diagonal: the squares between
+ * them, and the whole line through both of them. Both are 0 otherwise */
+BITBOARD between[64][64];
+BITBOARD line_through[64][64];
+
+/* Returns the set with square (row, col), or an empty set if it's off the board */
+BITBOARD
+SquareBB (int row, int col)
+{
+  if (row < 0 || row > 7 || col < 0 || col > 7)
+    return 0;
+  return BIT (row * 8 + col);
+}
+
+/* The squares seen from sq in direction d: the ray is cut after the
+ * first piece found, which can be captured */
+BITBOARD
+RayAttacks (int sq, int d, BITBOARD occupied)
+{
+  BITBOARD attacks = rays[d][sq];
+  BITBOARD blockers = attacks & occupied;
+  if (blockers)
+    {
+      /* The nearest blocker is the first square of the set when the
+       * ray goes towards higher squares, and the last one otherwise */
+      if (ray_row_step[d] > 0 || (ray_row_step[d] == 0 && ray_col_step[d] > 0))
+	attacks ^= rays[d][LSB (blockers)];
+      else
+	attacks ^= rays[d][MSB (blockers)];
+    }
+  return attacks;
+}
+
+/* The squares attacked by a bishop (or a rook) in sq, walking the rays one
+ * by one. It's too slow for the search, so we just use it to fill in the
+ * magic tables */
+BITBOARD
+SlowAttacks (int sq, BITBOARD occupied, int bishop)
+{
+  if (bishop)
+    return RayAttacks (sq, NORTH_EAST, occupied) |
+      RayAttacks (sq, NORTH_WEST, occupied) |
+      RayAttacks (sq, SOUTH_EAST, occupied) |
+      RayAttacks (sq, SOUTH_WEST, occupied);
+  return RayAttacks (sq, NORTH, occupied) |
+    RayAttacks (sq, SOUTH, occupied) |
+    RayAttacks (sq, EAST, occupied) | RayAttacks (sq, WEST, occupied);
+}
+
+/* * * * * * * * * * * * *
+ * Magic bitboards
+ * * * * * * * * * * * * */
+/* The attacks of a slider only depend on the pieces in its rays (the mask),
+ * and not even on the ones at the edge of the board. So for each square we
+ * store the attacks of every possible occupancy of the mask in a table, and
+ * the index for a given occupancy is
+ *
+ * ((occupied & mask) * magic) >> shift
+ *
+ * where magic is a number found by trial and error in such a way that two
+ * occupancies with different attacks never get the same index.
+ * When the CPU has the BMI2 instructions, PEXT packs the bits of the mask
+ * into the index in a single instruction and we don't need any magic. */
+typedef struct tag_MAGIC
+{
+  BITBOARD mask;		/* The squares whose occupancy matters */
+  BITBOARD magic;
+  BITBOARD *attacks;		/* Where the table of this square starts */
+  int shift;
+} MAGIC;
+
+MAGIC bishop_magic[64];
+MAGIC rook_magic[64];
+BITBOARD bishop_table[5248];	/* All the attacks of the bishops */
+BITBOARD rook_table[102400];	/* All the attacks of the rooks */
+
+int use_pext = 0;		/* 1 if the tables are indexed with PEXT */
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HAS_PEXT 1
+/* With inline assembly we don't need to compile the whole engine for BMI2 */
+BITBOARD
+Pext (BITBOARD occupied, BITBOARD mask)
+{
+  BITBOARD index;
+  __asm__ ("pextq %2, %1, %0":"=r" (index):"r" (occupied), "r" (mask));
+  return index;
+}
+#else
+#define HAS_PEXT 0
+#define Pext(occupied, mask) 0
+#endif
+
+/* The index in the table of the attacks for a given occupancy */
+unsigned
+MagicIndex (MAGIC * m, BITBOARD occupied)
+{
+  if (use_pext)
+    return (unsigned) Pext (occupied, m->mask);
+  return (unsigned) (((occupied & m->mask) * m->magic) >> m->shift);
+}
+
+/* The squares attacked by a bishop in sq */
+BITBOARD
+BishopAttacks (int sq, BITBOARD occupied)
+{
+  return bishop_magic[sq].attacks[MagicIndex (&bishop_magic[sq], occupied)];
+}
+
+/* The squares attacked by a rook in sq */
+BITBOARD
+RookAttacks (int sq, BITBOARD occupied)
+{
+  return rook_magic[sq].attacks[MagicIndex (&rook_magic[sq], occupied)];
+}
+
+/* A simple pseudo random numbers generator (xorshift). It always gives the
+ * same numbers after setting random_seed, so we always find the same magics */
+BITBOARD random_seed = 1070372ULL;
+
+BITBOARD
+Random64 ()
+{
+  random_seed ^= random_seed >> 12;
+  random_seed ^= random_seed << 25;
+  random_seed ^= random_seed >> 27;
+  return random_seed * 2685821657736338717ULL;
+}
+
+/* Find the magics and fill in the attack tables of the bishops (or rooks) */
+void
+InitMagics (MAGIC * magics, BITBOARD * table, int bishop)
+{
+  BITBOARD occupancy[4096];	/* All the occupancies of the mask */
+  BITBOARD reference[4096];	/* And the attacks for each of them */
+  int tried[4096];		/* The last attempt which used an index */
+  int attempt = 0;
+  int size;
+  int sq;
+  int i;
+  BITBOARD b;
+  BITBOARD edges;
+  MAGIC *m;
+
+  for (sq = 0; sq < 64; sq++)
+    {
+      m = &magics[sq];
+
+      /* The pieces at the edges don't matter, unless we are on that edge */
+      edges = ((0xFFULL | (0xFFULL << 56)) & ~(0xFFULL << (ROW (sq) * 8))) |
+	((0x0101010101010101ULL | (0x0101010101010101ULL << 7)) &
+	 ~(0x0101010101010101ULL << COL (sq)));
+      m->mask = SlowAttacks (sq, 0, bishop) & ~edges;
+      m->shift = 64 - POPCOUNT (m->mask);
+      m->attacks = table;
+
+      /* Go through all the subsets of the mask (Carry-Rippler trick) */
+      size = 0;
+      b = 0;
+      do
+	{
+	  occupancy[size] = b;
+	  reference[size] = SlowAttacks (sq, b, bishop);
+	  size++;
+	  b = (b - m->mask) & m->mask;
+	}
+      while (b);
+      table += size;
+
+      if (use_pext)
+	{
+	  for (i = 0; i < size; i++)
+	    m->attacks[Pext (occupancy[i], m->mask)] = reference[i];
+	  continue;
+	}
+
+      /* Try random numbers with few bits set until one works */
+      memset (tried, 0, sizeof (tried));
+      for (i = 0; i < size;)
+	{
+	  do
+	    m->magic = Random64 () & Random64 () & Random64 ();
+	  while (POPCOUNT ((m->magic * m->mask) >> 56) < 6);
+
+	  attempt++;
+	  for (i = 0; i < size; i++)
+	    {
+	      unsigned index = MagicIndex (m, occupancy[i]);
+	      if (tried[index] < attempt)
+		{
+		  tried[index] = attempt;
+		  m->attacks[index] = reference[i];
+		}
+	      else if (m->attacks[index] != reference[i])
+		break;		/* Two occupancies collide, try another magic */
+	    }
+	}
+    }
+}
+
+/* Fill in the attack tables. It has to be called once before anything else */
+void
+InitBitboards ()
+{
+  int sq;
+  int d;
+  int row;
+  int col;
+
+  for (sq = 0; sq < 64; sq++)
+    {
+      row = ROW (sq);
+      col = COL (sq);
+
+      knight_attacks[sq] =
+	SquareBB (row - 2, col - 1) | SquareBB (row - 2, col + 1) |
+	SquareBB (row - 1, col - 2) | SquareBB (row - 1, col + 2) |
+	SquareBB (row + 1, col - 2) | SquareBB (row + 1, col + 2) |
+	SquareBB (row + 2, col - 1) | SquareBB (row + 2, col + 1);
+
+      king_attacks[sq] =
+	SquareBB (row - 1, col - 1) | SquareBB (row - 1, col) |
+	SquareBB (row - 1, col + 1) | SquareBB (row, col - 1) |
+	SquareBB (row, col + 1) | SquareBB (row + 1, col - 1) |
+	SquareBB (row + 1, col) | SquareBB (row + 1, col + 1);
+
+      /* White pawns go up the board (towards row 0), black ones go down */
+      pawn_attacks[WHITE][sq] =
+	SquareBB (row - 1, col - 1) | SquareBB (row - 1, col + 1);
+      pawn_attacks[BLACK][sq] =
+	SquareBB (row + 1, col - 1) | SquareBB (row + 1, col + 1);
+
+      for (d = 0; d < 8; d++)
+	{
+	  int r = row + ray_row_step[d];
+	  int c = col + ray_col_step[d];
+	  rays[d][sq] = 0;
+	  for (; SquareBB (r, c); r += ray_row_step[d], c += ray_col_step[d])
+	    rays[d][sq] |= SquareBB (r, c);
+	}
+      bishop_rays[sq] = rays[NORTH_EAST][sq] | rays[NORTH_WEST][sq] |
+	rays[SOUTH_EAST][sq] | rays[SOUTH_WEST][sq];
+      rook_rays[sq] = rays[NORTH][sq] | rays[SOUTH][sq] |
+	rays[EAST][sq] | rays[WEST][sq];
+    }
+
+  /* Once we have all the rays, the lines are a ray and its opposite one */
+  for (sq = 0; sq < 64; sq++)
+    for (d = 0; d < 8; d++)
+      {
+	int opposite = d ^ 1;	/* NORTH-SOUTH, EAST-WEST... */
+	BITBOARD squares = rays[d][sq];
+	if (d >= NORTH_EAST)
+	  opposite = (NORTH_EAST + SOUTH_WEST) - d;	/* NE-SW and NW-SE */
+	while (squares)
+	  {
+	    int sq2 = LSB (squares);
+	    squares &= squares - 1;
+	    between[sq][sq2] = rays[d][sq] ^ rays[d][sq2] ^ BIT (sq2);
+	    line_through[sq][sq2] =
+	      rays[d][sq] | rays[opposite][sq] | BIT (sq);
+	  }
+      }
+
+  /* The sliders use PEXT when the CPU has it and magics otherwise */
+#if HAS_PEXT
+  use_pext = __builtin_cpu_supports ("bmi2") != 0;
+#endif
+  InitMagics (bishop_magic, bishop_table, 1);
+  InitMagics (rook_magic, rook_table, 0);
+}
+
+/*
+ ****************************************************************************
+ * Hashing *
+ ****************************************************************************
+ */
+/* Zobrist keys: there's a random number for each piece in each square, for
+ * the side to move, for each combination of castle rights and for the file
+ * of the eps square. The key of a position is the XOR of the numbers of
+ * everything in it, so when making a move we just XOR in and out what
+ * changes */
+HASHKEY zobrist_piece[2][6][64];
+HASHKEY zobrist_side;		/* XORed when black is to move */
+HASHKEY zobrist_castle[16];
+HASHKEY zobrist_eps[8];
+
+void
+InitHash ()
+{
+  int c;
+  int p;
+  int sq;
+
+  /* Always the same keys, no matter what has been drawn before */
+  random_seed = 0x9E3779B97F4A7C15ULL;
+  for (c = 0; c < 2; c++)
+    for (p = 0; p < 6; p++)
+      for (sq = 0; sq < 64; sq++)
+	zobrist_piece[c][p][sq] = Random64 ();
+  zobrist_side = Random64 ();
+  for (c = 0; c < 16; c++)
+    zobrist_castle[c] = Random64 ();
+  for (c = 0; c < 8; c++)
+    zobrist_eps[c] = Random64 ();
+}
+
+/* Calculate the key of the current position from scratch */
+HASHKEY
+HashKey (POSITION * pos)
+{
+  int sq;
+  HASHKEY key = 0;
+  BITBOARD pieces = pos->bb_all;
+
+  while (pieces)
+    {
+      sq = LSB (pieces);
+      pieces &= pieces - 1;
+      key ^= zobrist_piece[pos->color[sq]][pos->piece[sq]][sq];
+    }
+  if (pos->side == BLACK)
+    key ^= zobrist_side;
+  key ^= zobrist_castle[pos->castle_rights];
+  if (pos->eps_square != -1)
+    key ^= zobrist_eps[COL (pos->eps_square)];
+  return key;
+}
+
+/* The key of the pawns alone, for the pawn hash table, see Eval */
+HASHKEY
+PawnKey (POSITION * pos)
+{
+  int sq;
+  HASHKEY key = 0;
+  BITBOARD pawns = pos->bb_piece[WHITE][PAWN] | pos->bb_piece[BLACK][PAWN];
+
+  while (pawns)
+    {
+      sq = LSB (pawns);
+      pawns &= pawns - 1;
+      key ^= zobrist_piece[pos->color[sq]][PAWN][sq];
+    }
+  return key;
+}
+
 /*
  ****************************************************************************
  * Move generator *
  ****************************************************************************
  */
+int IsInCheck (POSITION * pos, int current_side);
+int IsAttacked (POSITION * pos, int current_side, int k);
+
 void
 Gen_Push (int from, int dest, int type, MOVE * pBuf, int *pMCount)
 {
-  MOVE move;
-  move.from = from;
-  move.dest = dest;
-  move.type = type;
-//      move.castle = castle;
-  pBuf[*pMCount] = move;
+  pBuf[*pMCount] = NEW_MOVE (from, dest, type);
   *pMCount = *pMCount + 1;
 }
 
@@ -334,11 +965,11 @@ Gen_PushNormal (int from, int dest, MOVE * pBuf, int *pMCount)
 
 /* Pawn can promote */
 void
-Gen_PushPawn (int from, int dest, MOVE * pBuf, int *pMCount)
+Gen_PushPawn (POSITION * pos, int from, int dest, MOVE * pBuf, int *pMCount)
 {
   /* The 7 and 56 are to limit pawns to the 2nd through 7th ranks, which
    * means this isn't a promotion, i.e., a normal pawn move */
-  if (piece[dest] == EPS_SQUARE)
+  if (dest == pos->eps_square)
     {
       Gen_Push (from, dest, MOVE_TYPE_EPS, pBuf, pMCount);
     }
@@ -381,547 +1012,654 @@ Gen_PushKing (int from, int dest, MOVE * pBuf, int *pMCount)
     }
 }
 
+/* Gen the castle moves of current_side, and return number of moves */
+int
+GenCastles (POSITION * pos, int current_side, MOVE * pBuf)
+{
+  int movecount = 0;
+
+  if (current_side == WHITE)
+    {
+      /* Can white short castle? */
+      if ((pos->castle_rights & 1) &&
+	  !(pos->bb_all & (BIT (F1) | BIT (G1))) &&
+	  !IsInCheck (pos, current_side) && !IsAttacked (pos, current_side, F1))
+	{
+	  /* The king goes 2 sq to the right */
+	  Gen_PushKing (E1, G1, pBuf, &movecount);
+	}
+
+      /* Can white long castle? */
+      if ((pos->castle_rights & 2) &&
+	  !(pos->bb_all & (BIT (B1) | BIT (C1) | BIT (D1))) &&
+	  !IsInCheck (pos, current_side) && !IsAttacked (pos, current_side, D1))
+	{
+	  /* The king goes 2 sq to the left */
+	  Gen_PushKing (E1, C1, pBuf, &movecount);
+	}
+    }
+  else
+    {
+      /* Can black short castle? */
+      if ((pos->castle_rights & 4) &&
+	  !(pos->bb_all & (BIT (F8) | BIT (G8))) &&
+	  !IsInCheck (pos, current_side) && !IsAttacked (pos, current_side, F8))
+	{
+	  Gen_PushKing (E8, G8, pBuf, &movecount);
+	}
+      /* Can black long castle? */
+      if ((pos->castle_rights & 8) &&
+	  !(pos->bb_all & (BIT (B8) | BIT (C8) | BIT (D8))) &&
+	  !IsInCheck (pos, current_side) && !IsAttacked (pos, current_side, D8))
+	{
+	  Gen_PushKing (E8, C8, pBuf, &movecount);
+	}
+    }
+
+  return movecount;
+}
+
 /* Gen all moves of current_side to move and push them to pBuf, and return number of moves */
 int
-GenMoves (int current_side, MOVE * pBuf)
+GenMoves (POSITION * pos, int current_side, MOVE * pBuf)
 {
-  int i;			/* Counter for the board squares */
-  int k;			/* Counter for cols */
-  int y;
-  int row;
-  int col;
+  int i;			/* The square of the piece */
+  int y;			/* The destiny square */
   int movecount;
+  int xside;
+  BITBOARD pieces;		/* The pieces of one kind we still have to look at */
+  BITBOARD targets;		/* The squares a piece can go to */
+  BITBOARD moves;
+  PROF_ENTER (pos);
+  xside = (WHITE + BLACK) - current_side;
+  targets = ~pos->bb_color[current_side];
   movecount = 0;
 
-  for (i = 0; i < 64; i++)	/* Scan all board */
-    if (color[i] == current_side)
-      {
-	switch (piece[i])
-	  {
-
-	  case PAWN:
-	    col = COL (i);
-	    row = ROW (i);
-	    if (current_side == BLACK)
-	      {
-		if (color[i + 8] == EMPTY)
-		  /* Pawn advances one square.
-		   * We use Gen_PushPawn because it can be a promotion */
-		  Gen_PushPawn (i, i + 8, pBuf, &movecount);
-		if (row == 1 && color[i + 8] == EMPTY
-		    && color[i + 16] == EMPTY)
-		  /* Pawn advances two squares */
-		  Gen_PushPawnTwo (i, i + 16, pBuf, &movecount);
-		if (col && color[i + 7] == WHITE)
-		  /* Pawn captures and it can be a promotion */
-		  Gen_PushPawn (i, i + 7, pBuf, &movecount);
-		if (col < 7 && color[i + 9] == WHITE)
-		  /* Pawn captures and can be a promotion */
-		  Gen_PushPawn (i, i + 9, pBuf, &movecount);
-		/* For en passant capture */
-		if (col && piece[i + 7] == EPS_SQUARE)
-		  /* Pawn captures and it can be a promotion */
-		  Gen_PushPawn (i, i + 7, pBuf, &movecount);
-		if (col < 7 && piece[i + 9] == EPS_SQUARE)
-		  /* Pawn captures and can be a promotion */
-		  Gen_PushPawn (i, i + 9, pBuf, &movecount);
-	      }
-	    else
-	      {
-		if (color[i - 8] == EMPTY)
-		  Gen_PushPawn (i, i - 8, pBuf, &movecount);
-		/* Pawn moves 2 squares */
-		if (row == 6 && color[i - 8] == EMPTY
-		    && color[i - 16] == EMPTY)
-		  Gen_PushPawnTwo (i, i - 16, pBuf, &movecount);
-		/* For captures */
-		if (col && color[i - 9] == BLACK)
-		  Gen_PushPawn (i, i - 9, pBuf, &movecount);
-		if (col < 7 && color[i - 7] == BLACK)
-		  Gen_PushPawn (i, i - 7, pBuf, &movecount);
-		/* For en passant capture */
-		if (col && piece[i - 9] == EPS_SQUARE)
-		  Gen_PushPawn (i, i - 9, pBuf, &movecount);
-		if (col < 7 && piece[i - 7] == EPS_SQUARE)
-		  Gen_PushPawn (i, i - 7, pBuf, &movecount);
-	      }
-	    break;
-
-	  case QUEEN:		/* == BISHOP+ROOK */
+  /* Pawns */
+  pieces = pos->bb_piece[current_side][PAWN];
+  while (pieces)
+    {
+      i = LSB (pieces);
+      pieces &= pieces - 1;
+      if (current_side == BLACK)
+	{
+	  if (!(pos->bb_all & BIT (i + 8)))
+	    {
+	      /* Pawn advances one square.
+	       * We use Gen_PushPawn because it can be a promotion */
+	      Gen_PushPawn (pos, i, i + 8, pBuf, &movecount);
+	      /* Pawn advances two squares */
+	      if (ROW (i) == 1 && !(pos->bb_all & BIT (i + 16)))
+		Gen_PushPawnTwo (i, i + 16, pBuf, &movecount);
+	    }
+	}
+      else
+	{
+	  if (!(pos->bb_all & BIT (i - 8)))
+	    {
+	      Gen_PushPawn (pos, i, i - 8, pBuf, &movecount);
+	      /* Pawn moves 2 squares */
+	      if (ROW (i) == 6 && !(pos->bb_all & BIT (i - 16)))
+		Gen_PushPawnTwo (i, i - 16, pBuf, &movecount);
+	    }
+	}
+      /* Pawn captures, including en passant, and it can be a promotion */
+      moves = pawn_attacks[current_side][i] & pos->bb_color[xside];
+      if (pos->eps_square != -1)
+	moves |= pawn_attacks[current_side][i] & BIT (pos->eps_square);
+      while (moves)
+	{
+	  y = LSB (moves);
+	  moves &= moves - 1;
+	  Gen_PushPawn (pos, i, y, pBuf, &movecount);
+	}
+    }
 
-	  case BISHOP:
-	    for (y = i - 9; y >= 0 && COL (y) != 7; y -= 9)
-	      {			/* go left up */
-		if (color[y] != current_side)
-		  Gen_PushNormal (i, y, pBuf, &movecount);
-		if (color[y] != EMPTY)
-		  break;
-	      }
-	    for (y = i - 7; y >= 0 && COL (y) != 0; y -= 7)
-	      {			/* go right up */
-		if (color[y] != current_side)
-		  Gen_PushNormal (i, y, pBuf, &movecount);
-		if (color[y] != EMPTY)
-		  break;
-	      }
-	    for (y = i + 9; y < 64 && COL (y) != 0; y += 9)
-	      {			/* go right down */
-		if (color[y] != current_side)
-		  Gen_PushNormal (i, y, pBuf, &movecount);
-		if (color[y] != EMPTY)
-		  break;
-	      }
-	    for (y = i + 7; y < 64 && COL (y) != 7; y += 7)
-	      {			/* go left down */
-		if (color[y] != current_side)
-		  Gen_PushNormal (i, y, pBuf, &movecount);
-		if (color[y] != EMPTY)
-		  break;
-	      }
-	    if (piece[i] == BISHOP)	/* In the case of the bishop we're done */
-	      break;
+  /* Knights */
+  pieces = pos->bb_piece[current_side][KNIGHT];
+  while (pieces)
+    {
+      i = LSB (pieces);
+      pieces &= pieces - 1;
+      moves = knight_attacks[i] & targets;
+      while (moves)
+	{
+	  y = LSB (moves);
+	  moves &= moves - 1;
+	  Gen_PushNormal (i, y, pBuf, &movecount);
+	}
+    }
 
-	    /* FALL THROUGH FOR QUEEN {I meant to do that!} ;-) */
-	  case ROOK:
-	    col = COL (i);
-	    for (k = i - col, y = i - 1; y >= k; y--)
-	      {			/* go left */
-		if (color[y] != current_side)
-		  Gen_PushNormal (i, y, pBuf, &movecount);
-		if (color[y] != EMPTY)
-		  break;
-	      }
-	    for (k = i - col + 7, y = i + 1; y <= k; y++)
-	      {			/* go right */
-		if (color[y] != current_side)
-		  Gen_PushNormal (i, y, pBuf, &movecount);
-		if (color[y] != EMPTY)
-		  break;
-	      }
-	    for (y = i - 8; y >= 0; y -= 8)
-	      {			/* go up */
-		if (color[y] != current_side)
-		  Gen_PushNormal (i, y, pBuf, &movecount);
-		if (color[y] != EMPTY)
-		  break;
-	      }
-	    for (y = i + 8; y < 64; y += 8)
-	      {			/* go down */
-		if (color[y] != current_side)
-		  Gen_PushNormal (i, y, pBuf, &movecount);
-		if (color[y] != EMPTY)
-		  break;
-	      }
-	    break;
+  /* Bishops and queens moving along the diagonals */
+  pieces =
+    pos->bb_piece[current_side][BISHOP] | pos->bb_piece[current_side][QUEEN];
+  while (pieces)
+    {
+      i = LSB (pieces);
+      pieces &= pieces - 1;
+      moves = BishopAttacks (i, pos->bb_all) & targets;
+      while (moves)
+	{
+	  y = LSB (moves);
+	  moves &= moves - 1;
+	  Gen_PushNormal (i, y, pBuf, &movecount);
+	}
+    }
 
-	  case KNIGHT:
-	    col = COL (i);
-	    y = i - 6;
-	    if (y >= 0 && col < 6 && color[y] != current_side)
-	      Gen_PushNormal (i, y, pBuf, &movecount);
-	    y = i - 10;
-	    if (y >= 0 && col > 1 && color[y] != current_side)
-	      Gen_PushNormal (i, y, pBuf, &movecount);
-	    y = i - 15;
-	    if (y >= 0 && col < 7 && color[y] != current_side)
-	      Gen_PushNormal (i, y, pBuf, &movecount);
-	    y = i - 17;
-	    if (y >= 0 && col > 0 && color[y] != current_side)
-	      Gen_PushNormal (i, y, pBuf, &movecount);
-	    y = i + 6;
-	    if (y < 64 && col > 1 && color[y] != current_side)
-	      Gen_PushNormal (i, y, pBuf, &movecount);
-	    y = i + 10;
-	    if (y < 64 && col < 6 && color[y] != current_side)
-	      Gen_PushNormal (i, y, pBuf, &movecount);
-	    y = i + 15;
-	    if (y < 64 && col > 0 && color[y] != current_side)
-	      Gen_PushNormal (i, y, pBuf, &movecount);
-	    y = i + 17;
-	    if (y < 64 && col < 7 && color[y] != current_side)
-	      Gen_PushNormal (i, y, pBuf, &movecount);
-	    break;
+  /* Rooks and queens moving along ranks and files */
+  pieces =
+    pos->bb_piece[current_side][ROOK] | pos->bb_piece[current_side][QUEEN];
+  while (pieces)
+    {
+      i = LSB (pieces);
+      pieces &= pieces - 1;
+      moves = RookAttacks (i, pos->bb_all) & targets;
+      while (moves)
+	{
+	  y = LSB (moves);
+	  moves &= moves - 1;
+	  Gen_PushNormal (i, y, pBuf, &movecount);
+	}
+    }
 
-	  case KING:
-	    /* the column and rank checks are to make sure it is on the board */
-	    /* The 'normal' moves */
-	    col = COL (i);
-	    if (col && color[i - 1] != current_side)
-	      Gen_PushKing (i, i - 1, pBuf, &movecount);	/* left */
-	    if (col < 7 && color[i + 1] != current_side)
-	      Gen_PushKing (i, i + 1, pBuf, &movecount);	/* right */
-	    if (i > 7 && color[i - 8] != current_side)
-	      Gen_PushKing (i, i - 8, pBuf, &movecount);	/* up */
-	    if (i < 56 && color[i + 8] != current_side)
-	      Gen_PushKing (i, i + 8, pBuf, &movecount);	/* down */
-	    if (col && i > 7 && color[i - 9] != current_side)
-	      Gen_PushKing (i, i - 9, pBuf, &movecount);	/* left up */
-	    if (col < 7 && i > 7 && color[i - 7] != current_side)
-	      Gen_PushKing (i, i - 7, pBuf, &movecount);	/* right up */
-	    if (col && i < 56 && color[i + 7] != current_side)
-	      Gen_PushKing (i, i + 7, pBuf, &movecount);	/* left down */
-	    if (col < 7 && i < 56 && color[i + 9] != current_side)
-	      Gen_PushKing (i, i + 9, pBuf, &movecount);	/* right down */
-
-	    /* The castle moves */
-	    if (current_side == WHITE)
-	      {
-		/* Can white short castle? */
-		if (castle_rights & 1)
-		  {
-		    /* If white can castle the white king has to be in square 60 */
-		    if (col &&
-			color[i + 1] == EMPTY &&
-			color[i + 2] == EMPTY &&
-			!IsInCheck (current_side) &&
-			!IsAttacked (current_side, i + 1))
-		      {
-			/* The king goes 2 sq to the left */
-			Gen_PushKing (i, i + 2, pBuf, &movecount);
-		      }
-		  }
+  /* King: the 'normal' moves */
+  i = pos->king_sq[current_side];
+  moves = king_attacks[i] & targets;
+  while (moves)
+    {
+      y = LSB (moves);
+      moves &= moves - 1;
+      Gen_PushKing (i, y, pBuf, &movecount);
+    }
 
-		/* Can white long castle? */
-		if (castle_rights & 2)
-		  {
-		    if (col &&
-			color[i - 1] == EMPTY &&
-			color[i - 2] == EMPTY &&
-			color[i - 3] == EMPTY &&
-			!IsInCheck (current_side) &&
-			!IsAttacked (current_side, i - 1))
-		      {
-			/* The king goes 2 sq to the left */
-			Gen_PushKing (i, i - 2, pBuf, &movecount);
-		      }
-		  }
-	      }
-	    else if (current_side == BLACK)
-	      {
-		/* Can black short castle? */
-		if (castle_rights & 4)
-		  {
-		    /* If white can castle the white king has to be in square 60 */
-		    if (col &&
-			color[i + 1] == EMPTY &&
-			color[i + 2] == EMPTY &&
-			piece[i + 3] == ROOK &&
-			!IsInCheck (current_side) &&
-			!IsAttacked (current_side, i + 1))
-		      {
-			/* The king goes 2 sq to the left */
-			Gen_PushKing (i, i + 2, pBuf, &movecount);
-		      }
-		  }
-		/* Can black long castle? */
-		if (castle_rights & 8)
-		  {
-		    if (col &&
-			color[i - 1] == EMPTY &&
-			color[i - 2] == EMPTY &&
-			color[i - 3] == EMPTY &&
-			piece[i - 4] == ROOK &&
-			!IsInCheck (current_side) &&
-			!IsAttacked (current_side, i - 1))
-		      {
-			/* The king goes 2 sq to the left */
-			Gen_PushKing (i, i - 2, pBuf, &movecount);
-		      }
-		  }
-	      }
+  /* The castle moves */
+  movecount += GenCastles (pos, current_side, pBuf + movecount);
 
-	    break;
-//                default:
-//                printf("Piece type unknown, %d", piece[i]);
-	    // assert(false);
-	  }
-      }
+  PROF_LEAVE (pos, PROF_GENMOVES);
   return movecount;
 }
 
 /* Gen all captures of current_side to move and push them to pBuf, return number of moves
  * It's necesary at least ir order to use quiescent in the search */
 int
-GenCaps (int current_side, MOVE * pBuf)
+GenCaps (POSITION * pos, int current_side, MOVE * pBuf)
 {
-  int i;			/* Counter for the board squares */
-  int k;			/* Counter for cols */
-  int y;
-  int row;
-  int col;
+  int i;			/* The square of the piece */
+  int y;			/* The destiny square */
   int capscount;		/* Counter for the posible captures */
   int xside;
+  BITBOARD pieces;
+  BITBOARD targets;		/* Only the enemy pieces */
+  BITBOARD moves;
+  PROF_ENTER (pos);
   xside = (WHITE + BLACK) - current_side;
+  targets = pos->bb_color[xside];
   capscount = 0;
 
-  for (i = 0; i < 64; i++)	/* Scan all board */
-    if (color[i] == current_side)
-      {
-	switch (piece[i])
-	  {
-
-	  case PAWN:
-	    col = COL (i);
-	    row = ROW (i);
-	    if (current_side == BLACK)
-	      {
-		/* This isn't a capture, but it's necesary in order to
-		 * not oversee promotions */
-		if (row > 7 && color[i + 8] == EMPTY)
-		  /* Pawn advances one square.
-		   * We use Gen_PushPawn because it can be a promotion */
-		  Gen_PushPawn (i, i + 8, pBuf, &capscount);
-		if (col && color[i + 7] == WHITE)
-		  /* Pawn captures and it can be a promotion */
-		  Gen_PushPawn (i, i + 7, pBuf, &capscount);
-		if (col < 7 && color[i + 9] == WHITE)
-		  /* Pawn captures and can be a promotion */
-		  Gen_PushPawn (i, i + 9, pBuf, &capscount);
-		/* For en passant capture */
-		if (col && piece[i + 7] == EPS_SQUARE)
-		  /* Pawn captures and it can be a promotion */
-		  Gen_PushPawn (i, i + 7, pBuf, &capscount);
-		if (col < 7 && piece[i + 9] == EPS_SQUARE)
-		  /* Pawn captures and can be a promotion */
-		  Gen_PushPawn (i, i + 9, pBuf, &capscount);
-	      }
-	    else if (current_side == WHITE)
-	      {
-		if (row < 2 && color[i - 8] == EMPTY)
-		  /* This isn't a capture, but it's necesary in order to
-		   * not oversee promotions */
-		  Gen_PushPawn (i, i - 8, pBuf, &capscount);
-		/* For captures */
-		if (col && color[i - 9] == BLACK)
-		  Gen_PushPawn (i, i - 9, pBuf, &capscount);
-		if (col < 7 && color[i - 7] == BLACK)
-		  Gen_PushPawn (i, i - 7, pBuf, &capscount);
-		/* For en passant capture */
-		if (col && piece[i - 9] == EPS_SQUARE)
-		  Gen_PushPawn (i, i - 9, pBuf, &capscount);
-		if (col < 7 && piece[i - 7] == EPS_SQUARE)
-		  Gen_PushPawn (i, i - 7, pBuf, &capscount);
-	      }
-	    break;
+  /* Pawns */
+  pieces = pos->bb_piece[current_side][PAWN];
+  while (pieces)
+    {
+      i = LSB (pieces);
+      pieces &= pieces - 1;
+      /* This isn't a capture, but it's necesary in order to
+       * not oversee promotions */
+      if (current_side == BLACK)
+	{
+	  if (ROW (i) == 6 && !(pos->bb_all & BIT (i + 8)))
+	    Gen_PushPawn (pos, i, i + 8, pBuf, &capscount);
+	}
+      else
+	{
+	  if (ROW (i) == 1 && !(pos->bb_all & BIT (i - 8)))
+	    Gen_PushPawn (pos, i, i - 8, pBuf, &capscount);
+	}
+      /* For captures, en passant included */
+      moves = pawn_attacks[current_side][i] & targets;
+      if (pos->eps_square != -1)
+	moves |= pawn_attacks[current_side][i] & BIT (pos->eps_square);
+      while (moves)
+	{
+	  y = LSB (moves);
+	  moves &= moves - 1;
+	  Gen_PushPawn (pos, i, y, pBuf, &capscount);
+	}
+    }
 
-	  case KNIGHT:
-	    col = COL (i);
-	    y = i - 6;
-	    if (y >= 0 && col < 6 && color[y] == xside)
-	      Gen_PushNormal (i, y, pBuf, &capscount);
-	    y = i - 10;
-	    if (y >= 0 && col > 1 && color[y] == xside)
-	      Gen_PushNormal (i, y, pBuf, &capscount);
-	    y = i - 15;
-	    if (y >= 0 && col < 7 && color[y] == xside)
-	      Gen_PushNormal (i, y, pBuf, &capscount);
-	    y = i - 17;
-	    if (y >= 0 && col > 0 && color[y] == xside)
-	      Gen_PushNormal (i, y, pBuf, &capscount);
-	    y = i + 6;
-	    if (y < 64 && col > 1 && color[y] == xside)
-	      Gen_PushNormal (i, y, pBuf, &capscount);
-	    y = i + 10;
-	    if (y < 64 && col < 6 && color[y] == xside)
-	      Gen_PushNormal (i, y, pBuf, &capscount);
-	    y = i + 15;
-	    if (y < 64 && col > 0 && color[y] == xside)
-	      Gen_PushNormal (i, y, pBuf, &capscount);
-	    y = i + 17;
-	    if (y < 64 && col < 7 && color[y] == xside)
-	      Gen_PushNormal (i, y, pBuf, &capscount);
-	    break;
+  /* Knights */
+  pieces = pos->bb_piece[current_side][KNIGHT];
+  while (pieces)
+    {
+      i = LSB (pieces);
+      pieces &= pieces - 1;
+      moves = knight_attacks[i] & targets;
+      while (moves)
+	{
+	  y = LSB (moves);
+	  moves &= moves - 1;
+	  Gen_PushNormal (i, y, pBuf, &capscount);
+	}
+    }
 
-	  case QUEEN:		/* == BISHOP+ROOK */
+  /* Bishops and queens */
+  pieces =
+    pos->bb_piece[current_side][BISHOP] | pos->bb_piece[current_side][QUEEN];
+  while (pieces)
+    {
+      i = LSB (pieces);
+      pieces &= pieces - 1;
+      moves = BishopAttacks (i, pos->bb_all) & targets;
+      while (moves)
+	{
+	  y = LSB (moves);
+	  moves &= moves - 1;
+	  Gen_PushNormal (i, y, pBuf, &capscount);
+	}
+    }
 
-	  case BISHOP:
-	    for (y = i - 9; y >= 0 && COL (y) != 7; y -= 9)
-	      {			/* go left up */
-		if (color[y] != EMPTY)
-		  {
-		    if (color[y] != current_side)
-		      Gen_PushNormal (i, y, pBuf, &capscount);
-		    break;
-		  }
-	      }
-	    for (y = i - 7; y >= 0 && COL (y) != 0; y -= 7)
-	      {			/* go right up */
-		if (color[y] != EMPTY)
-		  {
-		    if (color[y] != current_side)
-		      Gen_PushNormal (i, y, pBuf, &capscount);
-		    break;
-		  }
-	      }
-	    for (y = i + 9; y < 64 && COL (y) != 0; y += 9)
-	      {			/* go right down */
-		if (color[y] != EMPTY)
-		  {
-		    if (color[y] != current_side)
-		      Gen_PushNormal (i, y, pBuf, &capscount);
-		    break;
-		  }
-	      }
-	    for (y = i + 7; y < 64 && COL (y) != 7; y += 7)
-	      {			/* go left down */
-		if (color[y] != EMPTY)
-		  {
-		    if (color[y] != current_side)
-		      Gen_PushNormal (i, y, pBuf, &capscount);
-		    break;
-		  }
-	      }
-	    if (piece[i] == BISHOP)	/* In the case of the bishop we're done */
-	      break;
+  /* Rooks and queens */
+  pieces =
+    pos->bb_piece[current_side][ROOK] | pos->bb_piece[current_side][QUEEN];
+  while (pieces)
+    {
+      i = LSB (pieces);
+      pieces &= pieces - 1;
+      moves = RookAttacks (i, pos->bb_all) & targets;
+      while (moves)
+	{
+	  y = LSB (moves);
+	  moves &= moves - 1;
+	  Gen_PushNormal (i, y, pBuf, &capscount);
+	}
+    }
 
-	    /* FALL THROUGH FOR QUEEN {I meant to do that!} ;-) */
-	  case ROOK:
-	    col = COL (i);
-	    for (k = i - col, y = i - 1; y >= k; y--)
-	      {			/* go left */
-		if (color[y] != EMPTY)
-		  {
-		    if (color[y] != current_side)
-		      Gen_PushNormal (i, y, pBuf, &capscount);
-		    break;
-		  }
-	      }
-	    for (k = i - col + 7, y = i + 1; y <= k; y++)
-	      {			/* go right */
-		if (color[y] != EMPTY)
-		  {
-		    if (color[y] != current_side)
-		      Gen_PushNormal (i, y, pBuf, &capscount);
-		    break;
-		  }
-	      }
-	    for (y = i - 8; y >= 0; y -= 8)
-	      {			/* go up */
-		if (color[y] != EMPTY)
-		  {
-		    if (color[y] != current_side)
-		      Gen_PushNormal (i, y, pBuf, &capscount);
-		    break;
-		  }
-	      }
-	    for (y = i + 8; y < 64; y += 8)
-	      {			/* go down */
-		if (color[y] != EMPTY)
-		  {
-		    if (color[y] != current_side)
-		      Gen_PushNormal (i, y, pBuf, &capscount);
-		    break;
-		  }
-	      }
-	    break;
+  /* King */
+  i = pos->king_sq[current_side];
+  moves = king_attacks[i] & targets;
+  while (moves)
+    {
+      y = LSB (moves);
+      moves &= moves - 1;
+      Gen_PushKing (i, y, pBuf, &capscount);
+    }
 
-	  case KING:
-	    ///* the column and rank checks are to make sure it is on the board*/
-	    col = COL (i);
-	    if (col && color[i - 1] == xside)
-	      Gen_PushKing (i, i - 1, pBuf, &capscount);	/* left */
-	    if (col < 7 && color[i + 1] == xside)
-	      Gen_PushKing (i, i + 1, pBuf, &capscount);	/* right */
-	    if (i > 7 && color[i - 8] == xside)
-	      Gen_PushKing (i, i - 8, pBuf, &capscount);	/* up */
-	    if (i < 56 && color[i + 8] == xside)
-	      Gen_PushKing (i, i + 8, pBuf, &capscount);	/* down */
-	    if (col && i > 7 && color[i - 9] == xside)
-	      Gen_PushKing (i, i - 9, pBuf, &capscount);	/* left up */
-	    if (col < 7 && i > 7 && color[i - 7] == xside)
-	      Gen_PushKing (i, i - 7, pBuf, &capscount);	/* right up */
-	    if (col && i < 56 && color[i + 7] == xside)
-	      Gen_PushKing (i, i + 7, pBuf, &capscount);	/* left down */
-	    if (col < 7 && i < 56 && color[i + 9] == xside)
-	      Gen_PushKing (i, i + 9, pBuf, &capscount);	/* right down */
-	    break;
-//                               default:
-//                               printf("Piece type unknown");
-	    // assert(false);
-	  }
-      }
+  PROF_LEAVE (pos, PROF_GENCAPS);
   return capscount;
 }
 
+/* Gen all the moves of current_side which aren't captures or promotions,
+ * the ones GenCaps doesn't generate, and return number of moves. The search
+ * only needs them when the captures didn't give a cutoff */
+int
+GenQuiets (POSITION * pos, int current_side, MOVE * pBuf)
+{
+  int i;			/* The square of the piece */
+  int y;			/* The destiny square */
+  int movecount;		/* The number of moves */
+  BITBOARD pieces;
+  BITBOARD targets;		/* Only the empty squares */
+  BITBOARD moves;
+  PROF_ENTER (pos);
+  targets = ~pos->bb_all;
+  movecount = 0;
+
+  /* Pawns: just the pushes which aren't a promotion */
+  pieces = pos->bb_piece[current_side][PAWN];
+  while (pieces)
+    {
+      i = LSB (pieces);
+      pieces &= pieces - 1;
+      if (current_side == BLACK)
+	{
+	  if (ROW (i) != 6 && !(pos->bb_all & BIT (i + 8)))
+	    {
+	      Gen_PushNormal (i, i + 8, pBuf, &movecount);
+	      if (ROW (i) == 1 && !(pos->bb_all & BIT (i + 16)))
+		Gen_PushPawnTwo (i, i + 16, pBuf, &movecount);
+	    }
+	}
+      else
+	{
+	  if (ROW (i) != 1 && !(pos->bb_all & BIT (i - 8)))
+	    {
+	      Gen_PushNormal (i, i - 8, pBuf, &movecount);
+	      if (ROW (i) == 6 && !(pos->bb_all & BIT (i - 16)))
+		Gen_PushPawnTwo (i, i - 16, pBuf, &movecount);
+	    }
+	}
+    }
+
+  /* Knights */
+  pieces = pos->bb_piece[current_side][KNIGHT];
+  while (pieces)
+    {
+      i = LSB (pieces);
+      pieces &= pieces - 1;
+      moves = knight_attacks[i] & targets;
+      while (moves)
+	{
+	  y = LSB (moves);
+	  moves &= moves - 1;
+	  Gen_PushNormal (i, y, pBuf, &movecount);
+	}
+    }
+
+  /* Bishops and queens */
+  pieces =
+    pos->bb_piece[current_side][BISHOP] | pos->bb_piece[current_side][QUEEN];
+  while (pieces)
+    {
+      i = LSB (pieces);
+      pieces &= pieces - 1;
+      moves = BishopAttacks (i, pos->bb_all) & targets;
+      while (moves)
+	{
+	  y = LSB (moves);
+	  moves &= moves - 1;
+	  Gen_PushNormal (i, y, pBuf, &movecount);
+	}
+    }
+
+  /* Rooks and queens */
+  pieces =
+    pos->bb_piece[current_side][ROOK] | pos->bb_piece[current_side][QUEEN];
+  while (pieces)
+    {
+      i = LSB (pieces);
+      pieces &= pieces - 1;
+      moves = RookAttacks (i, pos->bb_all) & targets;
+      while (moves)
+	{
+	  y = LSB (moves);
+	  moves &= moves - 1;
+	  Gen_PushNormal (i, y, pBuf, &movecount);
+	}
+    }
+
+  /* King, castles included */
+  i = pos->king_sq[current_side];
+  moves = king_attacks[i] & targets;
+  while (moves)
+    {
+      y = LSB (moves);
+      moves &= moves - 1;
+      Gen_PushNormal (i, y, pBuf, &movecount);
+    }
+  movecount += GenCastles (pos, current_side, pBuf + movecount);
+
+  PROF_LEAVE (pos, PROF_GENQUIETS);
+  return movecount;
+}
+
+/* Returns 1 if m is a move GenMoves could generate for the side to move in
+ * this position. The hash move is tried before generating any move, and it
+ * may come from another position with the same index, so we must be sure it
+ * makes sense here */
+int
+IsPseudoLegal (POSITION * pos, MOVE m)
+{
+  int from = MOVE_FROM (m);
+  int dest = MOVE_DEST (m);
+  int type = MOVE_TYPE (m);
+  int side = pos->side;
+  int xside = (WHITE + BLACK) - side;
+  int forward = (side == WHITE) ? -8 : 8;	/* Where our pawns go */
+  MOVE castles[2];
+  int i, n;
+
+  if (type == MOVE_TYPE_NONE || pos->color[from] != side ||
+      pos->color[dest] == side)
+    return 0;
+
+  switch (pos->piece[from])
+    {
+    case PAWN:
+      if (type == MOVE_TYPE_PAWN_TWO)
+	return dest == from + 2 * forward &&
+	  ROW (from) == (side == WHITE ? 6 : 1) &&
+	  pos->piece[from + forward] == EMPTY && pos->piece[dest] == EMPTY;
+      if (type == MOVE_TYPE_EPS)
+	return dest == pos->eps_square &&
+	  (pawn_attacks[side][from] & BIT (dest));
+      /* A promotion if and only if it reaches the last row */
+      if ((dest < 8 || dest > 55) != (type >= MOVE_TYPE_PROMOTION_TO_QUEEN))
+	return 0;
+      if (type != MOVE_TYPE_NORMAL && type < MOVE_TYPE_PROMOTION_TO_QUEEN)
+	return 0;
+      if (dest == from + forward)
+	return pos->piece[dest] == EMPTY;
+      return pos->color[dest] == xside &&
+	(pawn_attacks[side][from] & BIT (dest));
+    case KNIGHT:
+      return type == MOVE_TYPE_NORMAL && (knight_attacks[from] & BIT (dest));
+    case BISHOP:
+      return type == MOVE_TYPE_NORMAL &&
+	(BishopAttacks (from, pos->bb_all) & BIT (dest));
+    case ROOK:
+      return type == MOVE_TYPE_NORMAL &&
+	(RookAttacks (from, pos->bb_all) & BIT (dest));
+    case QUEEN:
+      return type == MOVE_TYPE_NORMAL &&
+	((BishopAttacks (from, pos->bb_all) |
+	  RookAttacks (from, pos->bb_all)) & BIT (dest));
+    case KING:
+      if (type == MOVE_TYPE_NORMAL)
+	return (king_attacks[from] & BIT (dest)) != 0;
+      if (type != MOVE_TYPE_CASTLE)
+	return 0;
+      n = GenCastles (pos, side, castles);
+      for (i = 0; i < n; i++)
+	if (castles[i] == m)
+	  return 1;
+      return 0;
+    }
+  return 0;
+}
+
 /*
  ****************************************************************************
  * Evaluation for current position - main "brain" function *
  * Lack: almost no knowlegde; material value + piece square tables *
  ****************************************************************************
  */
+/* The score goes from the middlegame one to the endgame one as the pieces
+ * leave the board. There may be more than 24 with promotions */
+int
+Taper (int mg, int eg, int phase)
+{
+  if (phase > PHASE_MAX)
+    phase = PHASE_MAX;
+  return (mg * phase + eg * (PHASE_MAX - phase)) / PHASE_MAX;
+}
+
+#ifdef DEBUG_EVAL
+/* The middlegame and endgame scores and the phase of the position, from
+ * scratch. Returns 1 if they are the same we have been keeping */
 int
-Eval ()
+EvalIsRight (POSITION * pos)
 {
+  int sq;
+  int mg = 0;
+  int eg = 0;
+  int phase = 0;
+  BITBOARD pieces = pos->bb_all;
+
+  while (pieces)
+    {
+      sq = LSB (pieces);
+      pieces &= pieces - 1;
+      if (pos->color[sq] == WHITE)
+	{
+	  mg += value_piece[pos->piece[sq]] + pst_mg[pos->piece[sq]][sq];
+	  eg += value_piece[pos->piece[sq]] + pst_eg[pos->piece[sq]][sq];
+	}
+      else
+	{
+	  mg -= value_piece[pos->piece[sq]] + pst_mg[pos->piece[sq]][flip[sq]];
+	  eg -= value_piece[pos->piece[sq]] + pst_eg[pos->piece[sq]][flip[sq]];
+	}
+      phase += phase_piece[pos->piece[sq]];
+    }
+  return mg == pos->score_mg && eg == pos->score_eg && phase == pos->phase;
+}
+#endif
 
-  count_evaluations++;
+/* The pawn structure terms, in centipawns, middlegame and endgame */
+#define DOUBLED_MG 10		/* For each pawn in front of another one */
+#define DOUBLED_EG 20
+#define ISOLATED_MG 10		/* No friendly pawns in the files next to it */
+#define ISOLATED_EG 15
+#define BACKWARD_MG 8		/* Can't be defended and can't advance safely */
+#define BACKWARD_EG 10
 
-  /* A counter for the board squares */
-  int i;
+/* Passed pawns, by rank from their side's point of view */
+int passed_mg[8] = { 0, 5, 10, 15, 25, 40, 60, 0 };
+int passed_eg[8] = { 0, 10, 15, 25, 45, 70, 110, 0 };
 
-  /* The score of the position */
-  int score = 0;
+/* When nothing stands in the way of a passed pawn */
+int passed_free_eg[8] = { 0, 0, 5, 10, 20, 35, 60, 0 };
 
-  /* Check all the squares searching for the pieces */
-  for (i = 0; i < 64; i++)
+/* The pawn structure doesn't change often in the tree, so we calculate its
+ * score once and keep it in a small table of each search thread, together
+ * with where the passed pawns are. Just the pawn key is needed to find it */
+#define PAWN_HASH_SIZE 16384	/* Entries, a power of 2 */
+
+typedef struct tag_PAWNENTRY
+{
+  HASHKEY key;
+  BITBOARD passed[2];		/* The passed pawns of each side */
+  int score_mg;			/* From white's point of view */
+  int score_eg;
+} PAWNENTRY;
+
+typedef struct tag_PAWNHASH
+{
+  PAWNENTRY entry[PAWN_HASH_SIZE];
+  unsigned long long probes;	/* To know how often we find the structure */
+  unsigned long long hits;
+} PAWNHASH;
+
+/* Evaluate the pawn structure of the position and store it in e */
+void
+EvalPawns (POSITION * pos, PAWNENTRY * e)
+{
+  int c;
+  int sq;
+  int col;
+  int rank;
+  int stop;
+  int n;
+  int mg;
+  int eg;
+  BITBOARD own;
+  BITBOARD enemy;
+  BITBOARD pawns;
+
+  e->key = pos->pawn_key;
+  e->score_mg = 0;
+  e->score_eg = 0;
+  for (c = WHITE; c <= BLACK; c++)
     {
-      if (color[i] == WHITE)
-	{
-	  /* In the current square, add the material
-	   * value of the piece */
-	  score += value_piece[piece[i]];
+      own = pos->bb_piece[c][PAWN];
+      enemy = pos->bb_piece[(WHITE + BLACK) - c][PAWN];
+      e->passed[c] = 0;
+      mg = 0;
+      eg = 0;
 
-	  /* Now we add to the evaluation the value of the
-	   * piece square tables */
-	  switch (piece[i])
+      for (col = 0; col < 8; col++)
+	{
+	  n = POPCOUNT (own & file_mask[col]);
+	  if (n > 1)
 	    {
-	    case PAWN:
-	      score += pst_pawn[i];
-	      break;
-	    case KNIGHT:
-	      score += pst_knight[i];
-	      break;
-	    case BISHOP:
-	      score += pst_bishop[i];
-	      break;
-	    case ROOK:
-	      score += pst_rook[i];
-	      break;
-	    case KING:
-	      score += pst_king[i];
-	      break;
+	      mg -= DOUBLED_MG * (n - 1);
+	      eg -= DOUBLED_EG * (n - 1);
 	    }
 	}
-      /* Now the evaluation for black: note the change of
-         the sign in the score */
-      else if (color[i] == BLACK)
+
+      pawns = own;
+      while (pawns)
 	{
-	  score -= value_piece[piece[i]];
+	  sq = LSB (pawns);
+	  pawns &= pawns - 1;
+	  col = COL (sq);
+	  rank = (c == WHITE) ? 7 - ROW (sq) : ROW (sq);
+	  stop = (c == WHITE) ? sq - 8 : sq + 8;
 
-	  switch (piece[i])
+	  if (!(own & adjacent_files[col]))
 	    {
-	    case PAWN:
-	      score -= pst_pawn[flip[i]];
-	      break;
-	    case KNIGHT:
-	      score -= pst_knight[flip[i]];
-	      break;
-	    case BISHOP:
-	      score -= pst_bishop[flip[i]];
-	      break;
-	    case ROOK:
-	      score -= pst_rook[flip[i]];
-	      break;
-	    case KING:
-	      score -= pst_king[flip[i]];
-	      break;
+	      mg -= ISOLATED_MG;
+	      eg -= ISOLATED_EG;
+	    }
+	  else if (!(own & support_mask[c][sq]) &&
+		   (pawn_attacks[c][stop] & enemy))
+	    {
+	      mg -= BACKWARD_MG;
+	      eg -= BACKWARD_EG;
+	    }
+
+	  if (!(enemy & passed_mask[c][sq]))
+	    {
+	      e->passed[c] |= BIT (sq);
+	      mg += passed_mg[rank];
+	      eg += passed_eg[rank];
 	    }
 	}
+
+      e->score_mg += (c == WHITE) ? mg : -mg;
+      e->score_eg += (c == WHITE) ? eg : -eg;
+    }
+}
+
+/* Material and piece squares: MakeMove and TakeBack keep the scores and
+ * the phase up to date. The pawn structure comes from the pawn hash, and
+ * then we just have to mix them */
+int
+Eval (POSITION * pos, PAWNHASH * pawn_hash)
+{
+  int score;
+  int mg = pos->score_mg;
+  int eg = pos->score_eg;
+  int sq;
+  int stop;
+  BITBOARD passed;
+  PAWNENTRY *e = &pawn_hash->entry[pos->pawn_key & (PAWN_HASH_SIZE - 1)];
+
+  PROF_ENTER (pos);
+  pawn_hash->probes++;
+  if (e->key == pos->pawn_key)
+    pawn_hash->hits++;
+  else
+    EvalPawns (pos, e);
+  mg += e->score_mg;
+  eg += e->score_eg;
+
+  /* A passed pawn is worth more if it can advance */
+  passed = e->passed[WHITE];
+  while (passed)
+    {
+      sq = LSB (passed);
+      passed &= passed - 1;
+      stop = sq - 8;
+      if (pos->piece[stop] == EMPTY)
+	eg += passed_free_eg[7 - ROW (sq)];
+    }
+  passed = e->passed[BLACK];
+  while (passed)
+    {
+      sq = LSB (passed);
+      passed &= passed - 1;
+      stop = sq + 8;
+      if (pos->piece[stop] == EMPTY)
+	eg -= passed_free_eg[ROW (sq)];
     }
 
-  /* Finally we return the score, taking into account the side to move */
-  if (side == WHITE)
-    return score;
-  return -score;
+  score = Taper (mg, eg, pos->phase);
+
+  /* We return the score taking into account the side to move */
+  if (pos->side == BLACK)
+    score = -score;
+  PROF_LEAVE (pos, PROF_EVAL);
+  return score;
 }
 
 /*
@@ -933,671 +1671,2214 @@ Eval ()
 /* Check if current side is in check. Necesary in order to check legality of moves
  and check if castle is allowed */
 int
-IsInCheck (int current_side)
+IsInCheck (POSITION * pos, int current_side)
 {
-  int k;			/* The square where the king is placed */
-
-  /* Find the King of the side to move */
-  for (k = 0; k < 64; k++)
-    if ((piece[k] == KING) && color[k] == current_side)
-      break;
-
   /* Use IsAttacked in order to know if current_side is under check */
-  return IsAttacked (current_side, k);
+  return IsAttacked (pos, current_side, pos->king_sq[current_side]);
 }
 
-/* Returns 1 if square k is attacked by current_side, 0 otherwise. Necesary, v.g., to check
- * castle rules (if king goes from e1 to g1, f1 can't be attacked by an enemy piece) */
+/* Returns 1 if square k is attacked by the pieces of the opponent of current_side
+ * which are in the set enemies, with the board occupied as in occupied. This
+ * way we can ask about a position without actually making the move */
 int
-IsAttacked (int current_side, int k)
+IsAttackedOcc (POSITION * pos, int current_side, int k, BITBOARD occupied,
+	       BITBOARD enemies)
 {
-  int h;
-  int y;
-  int row;			/* Row where the square k is placed */
-  int col;			/* Col where the square k is placed */
+  BITBOARD sliders;		/* Enemy pieces that can attack from afar */
   int xside;
   xside = (WHITE + BLACK) - current_side;	/* opposite current_side, who may be attacking */
 
-  /* Situation of the square */
-  row = ROW (k);
-  col = COL (k);
-
-  /* Check Knight attack */
-  if (col > 0 && row > 1 && color[k - 17] == xside && piece[k - 17] == KNIGHT)
-    return 1;
-  if (col < 7 && row > 1 && color[k - 15] == xside && piece[k - 15] == KNIGHT)
-    return 1;
-  if (col > 1 && row > 0 && color[k - 10] == xside && piece[k - 10] == KNIGHT)
+  /* A piece standing on k would attack the very same squares it's attacked
+   * from, so we look at k as if it were each kind of piece. Pawns are the
+   * exception: we use the pawn attacks of current_side */
+  if (pawn_attacks[current_side][k] & pos->bb_piece[xside][PAWN] & enemies)
     return 1;
-  if (col < 6 && row > 0 && color[k - 6] == xside && piece[k - 6] == KNIGHT)
+  if (knight_attacks[k] & pos->bb_piece[xside][KNIGHT] & enemies)
     return 1;
-  if (col > 1 && row < 7 && color[k + 6] == xside && piece[k + 6] == KNIGHT)
+  if (king_attacks[k] & pos->bb_piece[xside][KING])
     return 1;
-  if (col < 6 && row < 7 && color[k + 10] == xside && piece[k + 10] == KNIGHT)
+  /* Diagonal lines for attacking of Queen and Bishop. We only walk
+   * the rays when there's a slider in them */
+  sliders =
+    (pos->bb_piece[xside][BISHOP] | pos->bb_piece[xside][QUEEN]) & enemies;
+  if ((bishop_rays[k] & sliders) && (BishopAttacks (k, occupied) & sliders))
     return 1;
-  if (col > 0 && row < 6 && color[k + 15] == xside && piece[k + 15] == KNIGHT)
-    return 1;
-  if (col < 7 && row < 6 && color[k + 17] == xside && piece[k + 17] == KNIGHT)
+  /* Horizontal and vertical lines for attacking of Queen and Rook */
+  sliders =
+    (pos->bb_piece[xside][ROOK] | pos->bb_piece[xside][QUEEN]) & enemies;
+  if ((rook_rays[k] & sliders) && (RookAttacks (k, occupied) & sliders))
     return 1;
+  return 0;
+}
+
+/* Returns 1 if square k is attacked by the opponent of current_side, 0 otherwise.
+ * Necesary, v.g., to check castle rules (if king goes from e1 to g1, f1 can't be
+ * attacked by an enemy piece) */
+int
+IsAttacked (POSITION * pos, int current_side, int k)
+{
+  int r;
+  PROF_ENTER (pos);
+  r = IsAttackedOcc (pos, current_side, k, pos->bb_all,
+		     pos->bb_color[(WHITE + BLACK) - current_side]);
+  PROF_LEAVE (pos, PROF_ISATTACKED);
+  return r;
+}
+
+/* All the pieces of both sides attacking square k, as IsAttackedOcc does
+ * but without stopping at the first one. The pieces already gone from
+ * occupied are still there, the caller has to take them out */
+BITBOARD
+AttackersTo (POSITION * pos, int k, BITBOARD occupied)
+{
+  BITBOARD diagonal = pos->bb_piece[WHITE][BISHOP] |
+    pos->bb_piece[BLACK][BISHOP] | pos->bb_piece[WHITE][QUEEN] |
+    pos->bb_piece[BLACK][QUEEN];
+  BITBOARD straight = pos->bb_piece[WHITE][ROOK] |
+    pos->bb_piece[BLACK][ROOK] | pos->bb_piece[WHITE][QUEEN] |
+    pos->bb_piece[BLACK][QUEEN];
+
+  return (pawn_attacks[WHITE][k] & pos->bb_piece[BLACK][PAWN]) |
+    (pawn_attacks[BLACK][k] & pos->bb_piece[WHITE][PAWN]) |
+    (knight_attacks[k] &
+     (pos->bb_piece[WHITE][KNIGHT] | pos->bb_piece[BLACK][KNIGHT])) |
+    (king_attacks[k] &
+     (pos->bb_piece[WHITE][KING] | pos->bb_piece[BLACK][KING])) |
+    (BishopAttacks (k, occupied) & diagonal) |
+    (RookAttacks (k, occupied) & straight);
+}
 
-  /* Check horizontal and vertical lines for attacking of Queen, Rook, King */
-  /* go down */
-  y = k + 8;
-  if (y < 64)
+/* Static Exchange Evaluation: what the side to move wins (or loses) with
+ * capture m if both sides keep on capturing in the dest square, each time
+ * with the least valuable piece, and each one can stop when it likes. No
+ * search at all, the pieces going away uncover the sliders behind them */
+int
+See (POSITION * pos, MOVE m)
+{
+  int from = MOVE_FROM (m);
+  int dest = MOVE_DEST (m);
+  int type = MOVE_TYPE (m);
+  int side = pos->side;
+  int piece = pos->piece[from];	/* The piece in dest, to be captured */
+  int gain[32];			/* gain[d]: material after d captures */
+  int d = 0;
+  int p;
+  BITBOARD occupied = pos->bb_all;
+  BITBOARD attackers;
+  BITBOARD mine;
+  BITBOARD diagonal = pos->bb_piece[WHITE][BISHOP] |
+    pos->bb_piece[BLACK][BISHOP] | pos->bb_piece[WHITE][QUEEN] |
+    pos->bb_piece[BLACK][QUEEN];
+  BITBOARD straight = pos->bb_piece[WHITE][ROOK] |
+    pos->bb_piece[BLACK][ROOK] | pos->bb_piece[WHITE][QUEEN] |
+    pos->bb_piece[BLACK][QUEEN];
+
+  if (type == MOVE_TYPE_EPS)
     {
-      if (color[y] == xside && (piece[y] == KING || piece[y] == QUEEN
-				|| piece[y] == ROOK))
-	return 1;
-      if (piece[y] == EMPTY || piece[y] == EPS_SQUARE)
-	for (y += 8; y < 64; y += 8)
-	  {
-	    if (color[y] == xside && (piece[y] == QUEEN || piece[y] == ROOK))
-	      return 1;
-	    if (piece[y] != EMPTY && piece[y] != EPS_SQUARE)
-	      break;
-	  }
+      gain[0] = value_piece[PAWN];
+      occupied ^= BIT (side == WHITE ? dest + 8 : dest - 8);
     }
-  /* go left */
-  y = k - 1;
-  h = k - col;
-  if (y >= h)
+  else if (pos->piece[dest] != EMPTY)
+    gain[0] = value_piece[pos->piece[dest]];
+  else
+    gain[0] = 0;
+  if (type >= MOVE_TYPE_PROMOTION_TO_QUEEN)
     {
-      if (color[y] == xside && (piece[y] == KING || piece[y] == QUEEN
-				|| piece[y] == ROOK))
-	return 1;
-      if (piece[y] == EMPTY || piece[y] == EPS_SQUARE)
-	for (y--; y >= h; y--)
-	  {
-	    if (color[y] == xside && (piece[y] == QUEEN || piece[y] == ROOK))
-	      return 1;
-	    if (piece[y] != EMPTY && piece[y] != EPS_SQUARE)
-	      break;
-	  }
+      piece = QUEEN - (type - MOVE_TYPE_PROMOTION_TO_QUEEN);
+      gain[0] += value_piece[piece] - value_piece[PAWN];
     }
-  /* go right */
-  y = k + 1;
-  h = k - col + 7;
-  if (y <= h)
+
+  occupied ^= BIT (from);
+  attackers = AttackersTo (pos, dest, occupied) & occupied;
+  while (1)
     {
-      if (color[y] == xside && (piece[y] == KING || piece[y] == QUEEN
-				|| piece[y] == ROOK))
-	return 1;
-      if (piece[y] == EMPTY || piece[y] == EPS_SQUARE)
-	for (y++; y <= h; y++)
-	  {
-	    if (color[y] == xside && (piece[y] == QUEEN || piece[y] == ROOK))
-	      return 1;
-	    if (piece[y] != EMPTY && piece[y] != EPS_SQUARE)
-	      break;
-	  }
+      d++;
+      side = (WHITE + BLACK) - side;
+      mine = attackers & pos->bb_color[side];
+      if (!mine)
+	break;
+      for (p = PAWN; p < KING; p++)
+	if (mine & pos->bb_piece[side][p])
+	  break;
+      /* The king can't capture a defended piece */
+      if (p == KING && (attackers & pos->bb_color[(WHITE + BLACK) - side]))
+	break;
+      gain[d] = value_piece[piece] - gain[d - 1];
+      piece = p;
+      occupied ^= BIT (LSB (mine & pos->bb_piece[side][p]));
+      attackers |= (BishopAttacks (dest, occupied) & diagonal) |
+	(RookAttacks (dest, occupied) & straight);
+      attackers &= occupied;
     }
-  /* go up */
-  y = k - 8;
-  if (y >= 0)
+
+  /* Now back from the end of the sequence: each side can stop capturing
+   * when going on would be worse */
+  while (--d)
+    if (gain[d] > -gain[d - 1])
+      gain[d - 1] = -gain[d];
+  return gain[0];
+}
+
+/* Returns 1 if move m gives check. Much faster than MakeMove and
+ * IsInCheck: we look at the board as it will be after the move, and just
+ * at the attacks of the moved piece and of the sliders it uncovers */
+int
+GivesCheck (POSITION * pos, MOVE m)
+{
+  int from = MOVE_FROM (m);
+  int dest = MOVE_DEST (m);
+  int type = MOVE_TYPE (m);
+  int side = pos->side;
+  int k = pos->king_sq[(WHITE + BLACK) - side];
+  int piece = pos->piece[from];
+  BITBOARD occupied = (pos->bb_all ^ BIT (from)) | BIT (dest);
+  BITBOARD diagonal = (pos->bb_piece[side][BISHOP] |
+		       pos->bb_piece[side][QUEEN]) & ~BIT (from);
+  BITBOARD straight = (pos->bb_piece[side][ROOK] |
+		       pos->bb_piece[side][QUEEN]) & ~BIT (from);
+  BITBOARD rook = 0;		/* The rook squares when castling */
+
+  if (type >= MOVE_TYPE_PROMOTION_TO_QUEEN)
+    piece = QUEEN - (type - MOVE_TYPE_PROMOTION_TO_QUEEN);
+  else if (type == MOVE_TYPE_EPS)
+    occupied ^= BIT (side == WHITE ? dest + 8 : dest - 8);
+  else if (type == MOVE_TYPE_CASTLE)
     {
-      if (color[y] == xside && (piece[y] == KING || piece[y] == QUEEN
-				|| piece[y] == ROOK))
-	return 1;
-      if (piece[y] == EMPTY || piece[y] == EPS_SQUARE)
-	for (y -= 8; y >= 0; y -= 8)
-	  {
-	    if (color[y] == xside && (piece[y] == QUEEN || piece[y] == ROOK))
-	      return 1;
-	    if (piece[y] != EMPTY && piece[y] != EPS_SQUARE)
-	      break;
-	  }
+      if (dest == G1)
+	rook = BIT (H1) | BIT (F1);
+      else if (dest == C1)
+	rook = BIT (A1) | BIT (D1);
+      else if (dest == G8)
+	rook = BIT (H8) | BIT (F8);
+      else
+	rook = BIT (A8) | BIT (D8);
+      occupied ^= rook;
+      straight ^= rook;
     }
-  /* Check diagonal lines for attacking of Queen, Bishop, King, Pawn */
-  /* go right down */
-  y = k + 9;
-  if (y < 64 && COL (y) != 0)
+
+  /* The moved piece itself */
+  if (piece == PAWN && (pawn_attacks[side][dest] & BIT (k)))
+    return 1;
+  if (piece == KNIGHT && (knight_attacks[dest] & BIT (k)))
+    return 1;
+  if (piece == BISHOP || piece == QUEEN)
+    diagonal |= BIT (dest);
+  if (piece == ROOK || piece == QUEEN)
+    straight |= BIT (dest);
+
+  /* And the sliders, which may see the king now through from */
+  if ((bishop_rays[k] & diagonal) && (BishopAttacks (k, occupied) & diagonal))
+    return 1;
+  if ((rook_rays[k] & straight) && (RookAttacks (k, occupied) & straight))
+    return 1;
+  return 0;
+}
+
+/* Returns 1 if the move m, generated by GenMoves for the side to move, doesn't
+ * leave our king in check. It's the same as MakeMove + IsInCheck + TakeBack,
+ * but we just look at the bitboards as they'd be after the move */
+int
+IsLegal (POSITION * pos, MOVE m)
+{
+  int from = MOVE_FROM (m);
+  int dest = MOVE_DEST (m);
+  int k;			/* Where our king will be */
+  BITBOARD occupied;		/* The occupied squares after the move */
+  BITBOARD enemies;		/* The enemy pieces which are still there */
+
+  k = (pos->piece[from] == KING) ? dest : pos->king_sq[pos->side];
+  occupied = (pos->bb_all & ~BIT (from)) | BIT (dest);
+  enemies = pos->bb_color[(WHITE + BLACK) - pos->side] & ~BIT (dest);
+
+  /* The pawn captured en passant isn't in the dest square */
+  if (MOVE_TYPE (m) == MOVE_TYPE_EPS)
     {
-      if (color[y] == xside)
-	{
-	  if (piece[y] == KING || piece[y] == QUEEN || piece[y] == BISHOP)
-	    return 1;
-	  if (current_side == BLACK && piece[y] == PAWN)
-	    return 1;
-	}
-      if (piece[y] == EMPTY || piece[y] == EPS_SQUARE)
-	for (y += 9; y < 64 && COL (y) != 0; y += 9)
-	  {
-	    if (color[y] == xside && (piece[y] == QUEEN || piece[y]
-				      == BISHOP))
-	      return 1;
-	    if (piece[y] != EMPTY && piece[y] != EPS_SQUARE)
-	      break;
-	  }
+      int cap_sq = (pos->side == WHITE) ? dest + 8 : dest - 8;
+      occupied &= ~BIT (cap_sq);
+      enemies &= ~BIT (cap_sq);
     }
-  /* go left down */
-  y = k + 7;
-  if (y < 64 && COL (y) != 7)
-    {
-      if (color[y] == xside)
-	{
-	  if (piece[y] == KING || piece[y] == QUEEN || piece[y] == BISHOP)
-	    return 1;
-	  if (current_side == BLACK && piece[y] == PAWN)
-	    return 1;
-	}
-      if (piece[y] == EMPTY || piece[y] == EPS_SQUARE)
-	for (y += 7; y < 64 && COL (y) != 7; y += 7)
-	  {
-	    if (color[y] == xside && (piece[y] == QUEEN || piece[y]
-				      == BISHOP))
-	      return 1;
-	    if (piece[y] != EMPTY && piece[y] != EPS_SQUARE)
-	      break;
 
-	  }
-    }
-  /* go left up */
-  y = k - 9;
-  if (y >= 0 && COL (y) != 7)
-    {
-      if (color[y] == xside)
-	{
-	  if (piece[y] == KING || piece[y] == QUEEN || piece[y] == BISHOP)
-	    return 1;
-	  if (current_side == WHITE && piece[y] == PAWN)
-	    return 1;
-	}
-      if (piece[y] == EMPTY || piece[y] == EPS_SQUARE)
-	for (y -= 9; y >= 0 && COL (y) != 7; y -= 9)
-	  {
-	    if (color[y] == xside && (piece[y] == QUEEN || piece[y]
-				      == BISHOP))
-	      return 1;
-	    if (piece[y] != EMPTY && piece[y] != EPS_SQUARE)
-	      break;
+  return !IsAttackedOcc (pos, pos->side, k, occupied, enemies);
+}
 
-	  }
+/* Gen all the legal moves of the side to move, and return number of moves.
+ * Instead of making each move to see if it leaves our king in check, we
+ * find once the pieces giving check and the pieces pinned to our king.
+ * Then a move is legal if it answers the check and, if the piece is pinned,
+ * it doesn't leave the line of the pin. Only the king moves and the en
+ * passant captures need a closer look, with IsLegal */
+int
+GenLegalMoves (POSITION * pos, MOVE * pBuf)
+{
+  int i;
+  int sq;
+  int from, dest;
+  int side = pos->side;
+  int xside = (WHITE + BLACK) - side;
+  int k = pos->king_sq[side];
+  int movecnt;
+  int legalcnt = 0;
+  BITBOARD diagonal;		/* Enemy bishops and queens */
+  BITBOARD straight;		/* Enemy rooks and queens */
+  BITBOARD checkers;		/* Enemy pieces giving check */
+  BITBOARD pinned = 0;		/* Our pieces pinned to our king */
+  BITBOARD evasions = ~0ULL;	/* Where the pieces must go to answer a check */
+  BITBOARD snipers;
+  BITBOARD b;
+  MOVE moveBuf[MAX_MOVES];
+  MOVE m;
+
+  diagonal = pos->bb_piece[xside][BISHOP] | pos->bb_piece[xside][QUEEN];
+  straight = pos->bb_piece[xside][ROOK] | pos->bb_piece[xside][QUEEN];
+  checkers = (pawn_attacks[side][k] & pos->bb_piece[xside][PAWN]) |
+    (knight_attacks[k] & pos->bb_piece[xside][KNIGHT]) |
+    (BishopAttacks (k, pos->bb_all) & diagonal) |
+    (RookAttacks (k, pos->bb_all) & straight);
+
+  /* A piece is pinned if it's the only one between our king and an enemy
+   * slider looking at it */
+  snipers = (bishop_rays[k] & diagonal) | (rook_rays[k] & straight);
+  while (snipers)
+    {
+      sq = LSB (snipers);
+      snipers &= snipers - 1;
+      b = between[k][sq] & pos->bb_all;
+      if (b && !(b & (b - 1)) && (b & pos->bb_color[side]))
+	pinned |= b;
     }
-  /* go right up */
-  y = k - 7;
-  if (y >= 0 && COL (y) != 0)
+
+  /* In check, we must capture the piece or put something in between. In
+   * double check only the king can move */
+  if (checkers)
+    evasions = (checkers & (checkers - 1)) ?
+      0 : checkers | between[k][LSB (checkers)];
+
+  movecnt = GenMoves (pos, side, moveBuf);
+  for (i = 0; i < movecnt; i++)
     {
-      if (color[y] == xside)
+      m = moveBuf[i];
+      from = MOVE_FROM (m);
+      dest = MOVE_DEST (m);
+      if (from == k || MOVE_TYPE (m) == MOVE_TYPE_EPS)
 	{
-	  if (piece[y] == KING || piece[y] == QUEEN || piece[y] == BISHOP)
-	    return 1;
-	  if (current_side == WHITE && piece[y] == PAWN)
-	    return 1;
+	  if (IsLegal (pos, m))
+	    pBuf[legalcnt++] = m;
 	}
-      if (piece[y] == EMPTY || piece[y] == EPS_SQUARE)
-	for (y -= 7; y >= 0 && COL (y) != 0; y -= 7)
-	  {
-	    if (color[y] == xside && (piece[y] == QUEEN || piece[y]
-				      == BISHOP))
-	      return 1;
-	    if (piece[y] != EMPTY && piece[y] != EPS_SQUARE)
-	      break;
-	  }
+      else if ((evasions & BIT (dest)) &&
+	       (!(pinned & BIT (from)) || (line_through[k][from] & BIT (dest))))
+	pBuf[legalcnt++] = m;
     }
-  return 0;
+
+  return legalcnt;
 }
 
-int
-MakeMove (MOVE m)
+/* Put a piece of color c and kind p in the empty square sq */
+void
+AddPiece (POSITION * pos, int sq, int c, int p)
+{
+  pos->piece[sq] = p;
+  pos->color[sq] = c;
+  pos->bb_piece[c][p] |= BIT (sq);
+  pos->bb_color[c] |= BIT (sq);
+  pos->bb_all |= BIT (sq);
+  pos->hash_key ^= zobrist_piece[c][p][sq];
+  pos->score_mg += piece_square_mg[c][p][sq];
+  pos->score_eg += piece_square_eg[c][p][sq];
+  pos->phase += phase_piece[p];
+  if (p == PAWN)
+    pos->pawn_key ^= zobrist_piece[c][p][sq];
+  if (p == KING)
+    pos->king_sq[c] = sq;
+}
+
+/* Take away whatever piece is in square sq */
+void
+RemovePiece (POSITION * pos, int sq)
 {
+  pos->bb_piece[pos->color[sq]][pos->piece[sq]] &= ~BIT (sq);
+  pos->bb_color[pos->color[sq]] &= ~BIT (sq);
+  pos->bb_all &= ~BIT (sq);
+  pos->hash_key ^= zobrist_piece[pos->color[sq]][pos->piece[sq]][sq];
+  pos->score_mg -= piece_square_mg[pos->color[sq]][pos->piece[sq]][sq];
+  pos->score_eg -= piece_square_eg[pos->color[sq]][pos->piece[sq]][sq];
+  pos->phase -= phase_piece[pos->piece[sq]];
+  if (pos->piece[sq] == PAWN)
+    pos->pawn_key ^= zobrist_piece[pos->color[sq]][PAWN][sq];
+  pos->piece[sq] = EMPTY;
+  pos->color[sq] = EMPTY;
+}
+
+/* Move the piece in from to the empty square dest */
+void
+MovePiece (POSITION * pos, int from, int dest)
+{
+  BITBOARD from_dest = BIT (from) | BIT (dest);
+  pos->bb_piece[pos->color[from]][pos->piece[from]] ^= from_dest;
+  pos->bb_color[pos->color[from]] ^= from_dest;
+  pos->bb_all ^= from_dest;
+  pos->hash_key ^= zobrist_piece[pos->color[from]][pos->piece[from]][from] ^
+    zobrist_piece[pos->color[from]][pos->piece[from]][dest];
+  pos->score_mg += piece_square_mg[pos->color[from]][pos->piece[from]][dest]
+    - piece_square_mg[pos->color[from]][pos->piece[from]][from];
+  pos->score_eg += piece_square_eg[pos->color[from]][pos->piece[from]][dest]
+    - piece_square_eg[pos->color[from]][pos->piece[from]][from];
+  if (pos->piece[from] == PAWN)
+    pos->pawn_key ^= zobrist_piece[pos->color[from]][PAWN][from] ^
+      zobrist_piece[pos->color[from]][PAWN][dest];
+  if (pos->piece[from] == KING)
+    pos->king_sq[pos->color[from]] = dest;
+  pos->piece[dest] = pos->piece[from];
+  pos->color[dest] = pos->color[from];
+  pos->piece[from] = EMPTY;
+  pos->color[from] = EMPTY;
+}
+
+int
+MakeMove (POSITION * pos, MOVE m)
+{
+  int from = MOVE_FROM (m);
+  int dest = MOVE_DEST (m);
+  int type = MOVE_TYPE (m);
   int r;
+
+  PROF_ENTER (pos);
+
+  pos->hist[pos->hdp].m = m;
+  pos->hist[pos->hdp].cap = pos->piece[dest];	/* store in history the piece of the dest square */
+  pos->hist[pos->hdp].castle = pos->castle_rights;
+  pos->hist[pos->hdp].eps = pos->eps_square;
+  pos->hist[pos->hdp].hash = pos->hash_key;
+
+  /* Remove the captured piece, if any, and then move the piece */
+  if (pos->piece[dest] != EMPTY)
+    RemovePiece (pos, dest);
+  MovePiece (pos, from, dest);
+
+  /* en pasant capture */
+  if (type == MOVE_TYPE_EPS)
+    {
+      if (pos->side == WHITE)
+	RemovePiece (pos, dest + 8);
+      else
+	RemovePiece (pos, dest - 8);
+    }
+
+  /* Remove possible eps square, remaining from former move, and add
+   * the new one when a pawn moves two squares */
+  if (pos->eps_square != -1)
+    pos->hash_key ^= zobrist_eps[COL (pos->eps_square)];
+  pos->eps_square = -1;
+  if (type == MOVE_TYPE_PAWN_TWO)
+    {
+      pos->eps_square = (from + dest) / 2;
+      pos->hash_key ^= zobrist_eps[COL (pos->eps_square)];
+    }
+
+  /* Once the move is done we check either this is a promotion */
+  if (type >= MOVE_TYPE_PROMOTION_TO_QUEEN)
+    {
+      /* In this case we put in the destiny sq the chosen piece */
+      RemovePiece (pos, dest);
+      switch (type)
+	{
+	case MOVE_TYPE_PROMOTION_TO_QUEEN:
+	  AddPiece (pos, dest, pos->side, QUEEN);
+	  break;
+
+	case MOVE_TYPE_PROMOTION_TO_ROOK:
+	  AddPiece (pos, dest, pos->side, ROOK);
+	  break;
+
+	case MOVE_TYPE_PROMOTION_TO_BISHOP:
+	  AddPiece (pos, dest, pos->side, BISHOP);
+	  break;
+
+	case MOVE_TYPE_PROMOTION_TO_KNIGHT:
+	  AddPiece (pos, dest, pos->side, KNIGHT);
+	  break;
+
+	default:
+	  puts ("Impossible to get here...");
+	  assert (false);
+	}
+    }
+
+  if (type == MOVE_TYPE_CASTLE)
+    {
+      if (dest == G1)
+	MovePiece (pos, H1, F1);
+      else if (dest == C1)
+	MovePiece (pos, A1, D1);
+      else if (dest == G8)
+	MovePiece (pos, H8, F8);
+      else if (dest == C8)
+	MovePiece (pos, A8, D8);
+    }
+
+  /* Update ply and hdp */
+  pos->ply++;
+  pos->hdp++;
+
+  /* Update the castle rights */
+  pos->hash_key ^= zobrist_castle[pos->castle_rights];
+  pos->castle_rights &= castle_mask[from] & castle_mask[dest];
+  pos->hash_key ^= zobrist_castle[pos->castle_rights];
+
+  /* Checking if after making the move we're in check */
+  r = !IsInCheck (pos, pos->side);
+
+  /* After making move, give turn to opponent */
+  pos->side = (WHITE + BLACK) - pos->side;
+  pos->hash_key ^= zobrist_side;
+
+#ifdef DEBUG_HASH
+  assert (pos->hash_key == HashKey (pos));
+  assert (pos->pawn_key == PawnKey (pos));
+#endif
+#ifdef DEBUG_EVAL
+  assert (EvalIsRight (pos));
+#endif
+
+  PROF_LEAVE (pos, PROF_MAKEMOVE);
+  return r;
+}
+
+/* Undo what MakeMove did */
+void
+TakeBack (POSITION * pos)
+{
+  MOVE m;
+  int from, dest, type;
+  PROF_ENTER (pos);
+
+  pos->side = (WHITE + BLACK) - pos->side;
+  pos->hdp--;
+  pos->ply--;
+  m = pos->hist[pos->hdp].m;
+  from = MOVE_FROM (m);
+  dest = MOVE_DEST (m);
+  type = MOVE_TYPE (m);
+
+  /* Update castle rights and the eps square */
+  pos->castle_rights = pos->hist[pos->hdp].castle;
+  pos->eps_square = pos->hist[pos->hdp].eps;
+
+  /* Promotion: the piece going back is a pawn */
+  if (type >= MOVE_TYPE_PROMOTION_TO_QUEEN)
+    {
+      RemovePiece (pos, dest);
+      AddPiece (pos, dest, pos->side, PAWN);
+    }
+
+  MovePiece (pos, dest, from);
+
+  /* Return the captured material */
+  if (pos->hist[pos->hdp].cap != EMPTY)
+    AddPiece (pos, dest, (WHITE + BLACK) - pos->side,
+	      pos->hist[pos->hdp].cap);
+
+  /* Unmaking an en pasant capture: the pawn comes back */
+  if (type == MOVE_TYPE_EPS)
+    {
+      if (pos->side == WHITE)
+	AddPiece (pos, dest + 8, BLACK, PAWN);
+      else
+	AddPiece (pos, dest - 8, WHITE, PAWN);
+    }
+
+  /* Undo Castle: return rook to its original square */
+  if (type == MOVE_TYPE_CASTLE)
+    {
+      if (dest == G1)
+	MovePiece (pos, F1, H1);
+      else if (dest == C1)
+	MovePiece (pos, D1, A1);
+      else if (dest == G8)
+	MovePiece (pos, F8, H8);
+      else if (dest == C8)
+	MovePiece (pos, D8, A8);
+    }
+
+  /* The pieces have been moved back, so the key is the one we had */
+  pos->hash_key = pos->hist[pos->hdp].hash;
+
+#ifdef DEBUG_HASH
+  assert (pos->hash_key == HashKey (pos));
+  assert (pos->pawn_key == PawnKey (pos));
+#endif
+#ifdef DEBUG_EVAL
+  assert (EvalIsRight (pos));
+#endif
+
+  PROF_LEAVE (pos, PROF_TAKEBACK);
+}
+
+/* Pass: the side to move changes and nothing else, but the eps square,
+ * which is lost. For the null move pruning, see Search */
+void
+MakeNullMove (POSITION * pos)
+{
+  pos->hist[pos->hdp].m = NO_MOVE;
+  pos->hist[pos->hdp].cap = EMPTY;
+  pos->hist[pos->hdp].castle = pos->castle_rights;
+  pos->hist[pos->hdp].eps = pos->eps_square;
+  pos->hist[pos->hdp].hash = pos->hash_key;
+  if (pos->eps_square != -1)
+    pos->hash_key ^= zobrist_eps[COL (pos->eps_square)];
+  pos->eps_square = -1;
+  pos->side = (WHITE + BLACK) - pos->side;
+  pos->hash_key ^= zobrist_side;
+  pos->hdp++;
+  pos->ply++;
+}
+
+void
+TakeBackNullMove (POSITION * pos)
+{
+  pos->side = (WHITE + BLACK) - pos->side;
+  pos->hdp--;
+  pos->ply--;
+  pos->eps_square = pos->hist[pos->hdp].eps;
+  pos->hash_key = pos->hist[pos->hdp].hash;
+}
+
+/* Write the move in s as xboard likes it, v.g. e2e4 or a7a8q. s must have
+ * room for 6 chars */
+void
+MoveToString (MOVE m, char *s)
+{
+  char *promotion = "qrbn";
+
+  sprintf (s, "%c%d%c%d", 'a' + COL (MOVE_FROM (m)), 8 - ROW (MOVE_FROM (m)),
+	   'a' + COL (MOVE_DEST (m)), 8 - ROW (MOVE_DEST (m)));
+  if (MOVE_TYPE (m) >= MOVE_TYPE_PROMOTION_TO_QUEEN)
+    {
+      s[4] = promotion[MOVE_TYPE (m) - MOVE_TYPE_PROMOTION_TO_QUEEN];
+      s[5] = '\0';
+    }
+}
+
+/*
+ ****************************************************************************
+ * Transposition table *
+ ****************************************************************************
+ */
+/* The same position is usually reached through different move orders, so
+ * we store the result of searching a position in a table indexed by its hash
+ * key. Each bucket has four entries and fills a cache line. An entry keeps
+ * the key XORed with the data, so if two threads write the same entry at the
+ * same time the mix won't match any key and we just won't use it: no locks
+ * are needed */
+#define HASH_EXACT 0		/* The score is exact */
+#define HASH_LOWER 1		/* The score is a lower bound, it failed high */
+#define HASH_UPPER 2		/* The score is an upper bound, it failed low */
+
+#define HASH_ENTRIES 4		/* Entries in each bucket */
+
+typedef struct tag_HASHENTRY
+{
+  HASHKEY check;		/* key ^ data */
+  unsigned long long data;	/* Move, score, depth, bound and age */
+} HASHENTRY;
+
+typedef struct tag_HASHBUCKET
+{
+  HASHENTRY entry[HASH_ENTRIES];
+} HASHBUCKET;
+
+/* How the data is packed in 64 bits */
+#define HASH_MOVE(data) ((MOVE) ((data) & 0xFFFF))
+#define HASH_SCORE(data) ((int) (short) (((data) >> 16) & 0xFFFF))
+#define HASH_DEPTH(data) ((int) (((data) >> 32) & 0xFF))
+#define HASH_BOUND(data) ((int) (((data) >> 40) & 0x3))
+#define HASH_AGE(data) ((int) (((data) >> 42) & 0x3F))
+
+typedef struct tag_HASHTABLE
+{
+  HASHBUCKET *buckets;
+  void *memory;			/* What malloc gave us, buckets is aligned */
+  unsigned long long size;	/* Number of buckets, always a power of 2 */
+  int age;			/* Incremented with each search, 6 bits */
+  int mb;			/* Size in MB */
+} HASHTABLE;
+
+/* Allocate a table of mb megabytes, or less to have a power of 2 buckets,
+ * and at least 1 MB. Returns 0 if there isn't memory enough, and then the
+ * old table is kept */
+int
+HashAlloc (HASHTABLE * table, int mb)
+{
+  unsigned long long size;
+  unsigned long long buckets = 1;
+  void *memory;
+
+  /* A negative size would become a huge one, and the loop wouldn't end */
+  if (mb < 1)
+    mb = 1;
+  size = (unsigned long long) mb * 1024 * 1024;
+  while (buckets * 2 * sizeof (HASHBUCKET) <= size)
+    buckets *= 2;
+  memory = malloc (buckets * sizeof (HASHBUCKET) + 63);
+  if (!memory)
+    return 0;
+  free (table->memory);
+  table->memory = memory;
+  table->size = buckets;
+  /* Align the buckets with the cache lines */
+  table->buckets =
+    (HASHBUCKET *) (((size_t) table->memory + 63) & ~(size_t) 63);
+  memset (table->buckets, 0, table->size * sizeof (HASHBUCKET));
+  table->mb = mb;
+  table->age = 0;
+  return 1;
+}
+
+/* Forget everything, v.g. for a new game */
+void
+HashClear (HASHTABLE * table)
+{
+  memset (table->buckets, 0, table->size * sizeof (HASHBUCKET));
+  table->age = 0;
+}
+
+/* Look for the current position in the table. Returns 1 if found, with the
+ * data of the entry in pData. Mate scores are stored as distance from the
+ * position, so we make them distance from the root again */
+int
+HashProbe (HASHTABLE * table, POSITION * pos, unsigned long long *pData)
+{
+  int i;
+  HASHKEY hash_key = pos->hash_key;
+  HASHBUCKET *bucket = &table->buckets[hash_key & (table->size - 1)];
+
+  for (i = 0; i < HASH_ENTRIES; i++)
+    {
+      /* Read once: another thread can be writing it right now */
+      HASHKEY check = bucket->entry[i].check;
+      unsigned long long data = bucket->entry[i].data;
+      if ((check ^ data) == hash_key)
+	{
+	  int score = HASH_SCORE (data);
+	  if (score > MATE - MAX_PLY)
+	    score -= pos->ply;
+	  else if (score < -MATE + MAX_PLY)
+	    score += pos->ply;
+	  *pData = (data & ~(0xFFFFULL << 16)) |
+	    ((unsigned long long) (unsigned short) score << 16);
+	  return 1;
+	}
+    }
+  return 0;
+}
+
+/* Store the result of searching the current position */
+void
+HashStore (HASHTABLE * table, POSITION * pos, int depth, int score,
+	   int bound, MOVE m)
+{
+  int i;
+  int worth;
+  int lowest_worth = 1000000;
+  HASHENTRY *replace = NULL;
+  HASHKEY hash_key = pos->hash_key;
+  HASHBUCKET *bucket = &table->buckets[hash_key & (table->size - 1)];
+  unsigned long long data;
+  MOVE move = m;
+
+  for (i = 0; i < HASH_ENTRIES; i++)
+    {
+      HASHENTRY *e = &bucket->entry[i];
+      unsigned long long old = e->data;
+
+      /* The same position: overwrite it, but keep the old best move if
+       * now we don't have any */
+      if ((e->check ^ old) == hash_key)
+	{
+	  if (!move)
+	    move = HASH_MOVE (old);
+	  replace = e;
+	  break;
+	}
+
+      /* Otherwise replace the least valuable entry: the shallowest one,
+       * where entries from former searches are worth less */
+      worth = HASH_DEPTH (old) - 8 * ((table->age - HASH_AGE (old)) & 0x3F);
+      if (worth < lowest_worth)
+	{
+	  lowest_worth = worth;
+	  replace = e;
+	}
+    }
+
+  /* Mate scores are stored as distance from this position */
+  if (score > MATE - MAX_PLY)
+    score += pos->ply;
+  else if (score < -MATE + MAX_PLY)
+    score -= pos->ply;
+
+  data = (unsigned long long) move |
+    ((unsigned long long) (unsigned short) score << 16) |
+    ((unsigned long long) depth << 32) |
+    ((unsigned long long) bound << 40) |
+    ((unsigned long long) table->age << 42);
+  replace->check = hash_key ^ data;
+  replace->data = data;
+}
+
+/* The perft cache: how many positions there are under a position to a
+ * given depth, so transposed subtrees are counted just once. As in the
+ * hash table the key is stored XORed with the data, so several threads can
+ * share it without locks: an entry half written by another one just won't
+ * match */
+typedef struct tag_PERFTENTRY
+{
+  HASHKEY check;		/* key ^ data */
+  unsigned long long data;	/* Count << 8 | depth */
+} PERFTENTRY;
+
+typedef struct tag_PERFTHASH
+{
+  PERFTENTRY *entries;		/* NULL if there's no cache */
+  unsigned long long size;	/* Number of entries, always a power of 2 */
+  int mb;			/* Size in MB */
+} PERFTHASH;
+
+#define PERFT_HASH_MB 64	/* Default size of the perft cache */
+
+/* Allocate a perft cache of mb megabytes, or none if mb is 0 */
+void
+PerftHashAlloc (PERFTHASH * table, int mb)
+{
+  unsigned long long size = (unsigned long long) mb * 1024 * 1024;
+
+  free (table->entries);
+  table->entries = NULL;
+  table->size = 0;
+  table->mb = 0;
+  if (mb <= 0)
+    return;
+  table->size = 1;
+  while (table->size * 2 * sizeof (PERFTENTRY) <= size)
+    table->size *= 2;
+  table->entries = calloc (table->size, sizeof (PERFTENTRY));
+  if (!table->entries)
+    {
+      puts ("Not enough memory for the perft cache");
+      table->size = 0;
+      return;
+    }
+  table->mb = mb;
+}
+
+/*
+ ****************************************************************************
+ * Engine state *
+ ****************************************************************************
+ */
+/* Everything an engine needs to play lives in an ENGINE: the game, the
+ * hash table, the clock and the search threads. There is nothing global
+ * but some constant tables, so a program can have as many engines as it
+ * wants, see the Engine API below and secondchess.h */
+
+/* A search thread. Each one searches on its own copy of the position and
+ * has its own counters */
+typedef struct tag_SEARCH
+{
+  POSITION pos;			/* The board this thread searches on */
+  ENGINE *engine;		/* The engine it searches for */
+  pthread_t handle;
+  int id;			/* 0 for the main thread */
+  int depth;			/* Max depth to search */
+  int search_depth;		/* The iteration we are searching */
+  MOVE best;			/* The result of the last finished iteration */
+  int best_score;
+  int best_depth;
+  unsigned long long nodes;	/* Count all visited nodes when searching */
+
+  /* For the move ordering, see the move picker */
+  MOVE killers[MAX_PLY][2];	/* Quiet moves with a cutoff in each ply */
+  int history[2][64][64];	/* Cutoffs of each side, from and dest */
+
+  /* Triangular array with the principal variation found in each ply:
+   * pv[ply] is the best move there and then the pv of the next ply */
+  MOVE pv[MAX_PLY][MAX_PLY];
+  int pv_length[MAX_PLY];
+
+  int null_verification;	/* No null moves while verifying one */
+
+  PAWNHASH pawn_hash;		/* Of its own, so no locks are needed */
+} SEARCH;
+
+struct tag_ENGINE
+{
+  POSITION pos;			/* The game */
+  HASHTABLE hash;		/* Shared by all the threads */
+
+  /* All times are in milliseconds */
+  int time_left;		/* Time in our clock, -1 if we aren't playing with clock */
+  int time_inc;			/* Increment per move */
+  int moves_per_session;	/* Moves until the next time control, 0 for all the game */
+  int time_per_move;		/* Fixed time for each move (xboard st), -1 if none */
+  long long search_start;	/* When the current search started */
+  long long time_soft;		/* Don't start a new iteration after this, -1 for no limit */
+  long long time_hard;		/* Stop the search right now after this, -1 for no limit */
+  volatile int stop_search;	/* Set when the search has to stop */
+
+  int num_threads;		/* Threads to search with, main one included */
+  SEARCH *threads;
+  int post;			/* Print the thinking output and the result */
+  PERFTHASH perft_hash;		/* Only allocated when perft is run */
+
+  /* The selective search can be switched off, to compare, see
+   * EngineSetOption */
+  int use_null_move;
+  int use_lmr;
+  int use_futility;
+  int use_reverse_futility;
+};
+
+/*
+ ****************************************************************************
+ * Time management *
+ ****************************************************************************
+ */
+/* Wall clock time, which never goes back */
+long long
+GetTime ()
+{
+#ifdef _WIN32
+  return GetTickCount64 ();
+#else
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+/* Decide how long to think about the move. We split our clock between the
+ * moves to the next time control (or 30, if it's the whole game) and add
+ * most of the increment. That's what we aim for, but if an iteration isn't
+ * finished we can use up to four times as much, with a limit of a third of
+ * our clock */
+void
+SetTimeLimits (ENGINE * engine)
+{
+  int moves_to_go;
+  long long budget;
+  long long time_left = engine->time_left;
+  int margin = 50;		/* Don't lose on time because of the lag */
+
+  engine->search_start = GetTime ();
+  engine->time_soft = -1;
+  engine->time_hard = -1;
+
+  if (engine->time_per_move != -1)
+    {
+      engine->time_soft = engine->time_hard =
+	engine->time_per_move > 2 * margin ?
+	engine->time_per_move - margin : engine->time_per_move / 2;
+      return;
+    }
+  if (time_left == -1)
+    return;
+
+  if (engine->moves_per_session)
+    moves_to_go = engine->moves_per_session -
+      (engine->pos.hdp / 2) % engine->moves_per_session;
+  else
+    moves_to_go = 30;
+
+  budget = time_left / moves_to_go + engine->time_inc * 3 / 4;
+  engine->time_hard = budget * 4;
+  if (engine->time_hard > time_left / 3)
+    engine->time_hard = time_left / 3;
+  if (engine->time_hard > time_left - margin)
+    engine->time_hard = time_left - margin;
+  if (engine->time_hard < 1)
+    engine->time_hard = 1;
+  engine->time_soft = budget < engine->time_hard ? budget : engine->time_hard;
+}
+
+/* Called every now and then from the search, to stop it when time is over.
+ * The first iteration is always finished, so we always have a move. Only the
+ * main thread looks at the clock, the others stop when it tells them */
+void
+CheckTime (SEARCH * search)
+{
+  ENGINE *engine = search->engine;
+
+  if (search->id == 0 && engine->time_hard != -1 && search->search_depth > 1
+      && GetTime () - engine->search_start >= engine->time_hard)
+    engine->stop_search = 1;
+}
+
+/*
+ ****************************************************************************
+ * Search function - a typical alphabeta, main search function *
+ * The moves are ordered by the move picker *
+ ****************************************************************************
+ */
+
+int Quiescent (SEARCH * search, int alpha, int beta, int qdepth);
+
+/* Bring the move with the highest score among moveBuf[i]...moveBuf[movecnt-1]
+ * to moveBuf[i]. We just need the best one each time, and after a cutoff we
+ * don't need the rest at all, so there is no point in sorting all of them */
+void
+PickMove (MOVE * moveBuf, int *moveScore, int i, int movecnt)
+{
+  int j;
+  int best = i;
+  MOVE tmpMove;
+  int tmpScore;
+
+  for (j = i + 1; j < movecnt; j++)
+    if (moveScore[j] > moveScore[best])
+      best = j;
+  if (best != i)
+    {
+      tmpMove = moveBuf[i];
+      moveBuf[i] = moveBuf[best];
+      moveBuf[best] = tmpMove;
+      tmpScore = moveScore[i];
+      moveScore[i] = moveScore[best];
+      moveScore[best] = tmpScore;
+    }
+}
+
+/* The move picker gives the moves of a node one by one, and it generates
+ * them in stages: first the hash move, which doesn't need any generation at
+ * all, then the captures, the best ones first, then the killers and at last
+ * the quiet moves, ordered by their history. Most of the time one of the
+ * first moves gives a cutoff, and then the quiet moves are never generated */
+#define STAGE_HASH 0
+#define STAGE_GEN_CAPS 1
+#define STAGE_CAPS 2
+#define STAGE_KILLERS 3
+#define STAGE_GEN_QUIETS 4
+#define STAGE_QUIETS 5
+#define STAGE_DONE 6
+
+/* Which moves the picker gives */
+#define PICK_ALL 0		/* For Search */
+#define PICK_CAPTURES 1		/* Only the captures and promotions */
+#define PICK_CHECKS 2		/* And the quiet moves which give check */
+
+typedef struct tag_MOVEPICKER
+{
+  MOVE moveBuf[MAX_MOVES];	/* The moves of the current stage */
+  int moveScore[MAX_MOVES];	/* To try the best ones first */
+  int movecnt;
+  int next;			/* The next move to give */
+  int stage;
+  int quiescent;		/* PICK_CAPTURES or PICK_CHECKS, for Quiescent */
+  MOVE hash_move;
+  MOVE killers[2];
+} MOVEPICKER;
+
+void
+InitPicker (SEARCH * search, MOVEPICKER * picker, MOVE hash_move,
+	    int quiescent)
+{
+  picker->movecnt = 0;
+  picker->next = 0;
+  picker->stage = STAGE_HASH;
+  picker->quiescent = quiescent;
+  picker->hash_move = hash_move;
+  picker->killers[0] = picker->killers[1] = NO_MOVE;
+  if (!quiescent)
+    {
+      picker->killers[0] = search->killers[search->pos.ply][0];
+      picker->killers[1] = search->killers[search->pos.ply][1];
+    }
+}
+
+/* Neither a capture nor a promotion */
+int
+IsQuiet (POSITION * pos, MOVE m)
+{
+  return pos->piece[MOVE_DEST (m)] == EMPTY &&
+    MOVE_TYPE (m) != MOVE_TYPE_EPS &&
+    MOVE_TYPE (m) < MOVE_TYPE_PROMOTION_TO_QUEEN;
+}
+
+/* How good a capture or a promotion looks: the most valuable victim first,
+ * and for the same victim the least valuable attacker first (MVV-LVA) */
+int
+CaptureScore (POSITION * pos, MOVE m)
+{
+  int type = MOVE_TYPE (m);
+  int score = 0;
+
+  if (type == MOVE_TYPE_EPS)
+    score = value_piece[PAWN];
+  else if (pos->piece[MOVE_DEST (m)] != EMPTY)
+    score = value_piece[pos->piece[MOVE_DEST (m)]];
+  if (type >= MOVE_TYPE_PROMOTION_TO_QUEEN)
+    score += value_piece[QUEEN - (type - MOVE_TYPE_PROMOTION_TO_QUEEN)] -
+      value_piece[PAWN];
+  return score * 8 - pos->piece[MOVE_FROM (m)];
+}
+
+/* The next move to try, or NO_MOVE if there aren't more. The moves are
+ * pseudo legal, as the ones of GenMoves */
+MOVE
+NextMove (SEARCH * search, MOVEPICKER * picker)
+{
+  POSITION *pos = &search->pos;
+  MOVE m;
   int i;
-  
-  count_MakeMove++;
 
-  hist[hdp].m = m;
-  hist[hdp].cap = piece[m.dest];	/* store in history the piece of the dest square */
-  hist[hdp].castle = castle_rights;
+  for (;;)
+    switch (picker->stage)
+      {
+      case STAGE_HASH:
+	picker->stage = STAGE_GEN_CAPS;
+	if (picker->hash_move != NO_MOVE &&
+	    IsPseudoLegal (pos, picker->hash_move))
+	  return picker->hash_move;
+	break;
+
+      case STAGE_GEN_CAPS:
+	picker->movecnt = GenCaps (pos, pos->side, picker->moveBuf);
+	for (i = 0; i < picker->movecnt; i++)
+	  picker->moveScore[i] = CaptureScore (pos, picker->moveBuf[i]);
+	picker->next = 0;
+	picker->stage = STAGE_CAPS;
+	break;
+
+      case STAGE_CAPS:
+	while (picker->next < picker->movecnt)
+	  {
+	    PickMove (picker->moveBuf, picker->moveScore, picker->next,
+		      picker->movecnt);
+	    m = picker->moveBuf[picker->next++];
+	    if (m != picker->hash_move)
+	      return m;
+	  }
+	picker->next = 0;
+	if (picker->quiescent == PICK_CAPTURES)
+	  picker->stage = STAGE_DONE;
+	else if (picker->quiescent == PICK_CHECKS)
+	  picker->stage = STAGE_GEN_QUIETS;
+	else
+	  picker->stage = STAGE_KILLERS;
+	break;
+
+      case STAGE_KILLERS:
+	/* The killers come from other positions at the same ply, so they
+	 * may not even be possible here */
+	while (picker->next < 2)
+	  {
+	    m = picker->killers[picker->next++];
+	    if (m != NO_MOVE && m != picker->hash_move &&
+		IsPseudoLegal (pos, m) && IsQuiet (pos, m))
+	      return m;
+	  }
+	picker->stage = STAGE_GEN_QUIETS;
+	break;
+
+      case STAGE_GEN_QUIETS:
+	picker->movecnt = GenQuiets (pos, pos->side, picker->moveBuf);
+	for (i = 0; i < picker->movecnt; i++)
+	  picker->moveScore[i] =
+	    search->history[pos->side][MOVE_FROM (picker->moveBuf[i])]
+	    [MOVE_DEST (picker->moveBuf[i])];
+	picker->next = 0;
+	picker->stage = STAGE_QUIETS;
+	break;
+
+      case STAGE_QUIETS:
+	while (picker->next < picker->movecnt)
+	  {
+	    PickMove (picker->moveBuf, picker->moveScore, picker->next,
+		      picker->movecnt);
+	    m = picker->moveBuf[picker->next++];
+	    if (picker->quiescent == PICK_CHECKS && !GivesCheck (pos, m))
+	      continue;
+	    if (m != picker->hash_move && m != picker->killers[0] &&
+		m != picker->killers[1])
+	      return m;
+	  }
+	picker->stage = STAGE_DONE;
+	break;
+
+      default:
+	return NO_MOVE;
+      }
+}
+
+/* A quiet move gave a cutoff: it's a killer in this ply from now on, and
+ * its history gets better, more the deeper the search was */
+void
+UpdateQuietCutoff (SEARCH * search, MOVE m, int depth)
+{
+  POSITION *pos = &search->pos;
+  int *h = &search->history[pos->side][MOVE_FROM (m)][MOVE_DEST (m)];
+  int from, dest;
+
+  if (search->killers[pos->ply][0] != m)
+    {
+      search->killers[pos->ply][1] = search->killers[pos->ply][0];
+      search->killers[pos->ply][0] = m;
+    }
+
+  *h += depth * depth;
+  /* Don't let it grow for ever: halve all of them, so the recent
+   * cutoffs are worth more than the old ones */
+  if (*h > 1000000)
+    for (from = 0; from < 64; from++)
+      for (dest = 0; dest < 64; dest++)
+	search->history[pos->side][from][dest] /= 2;
+}
+
+/* The margins of the pruning near the leaves, by depth */
+#define REVERSE_FUTILITY_MARGIN 120
+int futility_margin[4] = { 0, 200, 300, 500 };
+
+int
+Search (SEARCH * search, int alpha, int beta, int depth, MOVE * pBestMove)
+{
+  POSITION *pos = &search->pos;
+  ENGINE *engine = search->engine;
+  int value;			/* To store the evaluation */
+  int best;			/* The best value found so far */
+  int havemove;			/* Either we have or not a legal move available */
+  int old_alpha = alpha;	/* To know if we found an exact score */
+  int ply = pos->ply;
+  int i;
+  int pv_node = beta - alpha > 1;	/* Not searched with a null window */
+  int in_check;
+  int static_eval = 0;
+  int pieces;			/* Pieces but pawns and king of the side to move */
+  int searched = 0;		/* Legal moves searched so far */
+  int reduction;
+  int late;			/* A quiet move we can search less */
+  MOVE hash_move = NO_MOVE;	/* The best move stored in the hash table */
+  unsigned long long data;	/* The hash table entry */
+
+  MOVEPICKER picker;		/* Gives us the moves to try */
+  MOVE m;
+  MOVE tmpMove;
+
+  search->nodes++;		/* visiting a node, count it */
+  if ((search->nodes & 1023) == 0)
+    CheckTime (search);
+  havemove = 0;			/* is there a move available? */
+  best = -MATE;
+  *pBestMove = NO_MOVE;
+  search->pv_length[ply] = 0;
+
+  /* So deep we can't go on, the arrays of the ply are full */
+  if (ply >= MAX_PLY - 1)
+    return Eval (pos, &search->pawn_hash);
+
+  /* Check extension: the checks are searched one ply deeper, they are
+   * forcing and often lead to something */
+  in_check = IsInCheck (pos, pos->side);
+  if (in_check)
+    depth++;
+
+  /* Have we already searched this position deep enough? At the root
+   * we always search, since we need a move */
+  if (HashProbe (&engine->hash, pos, &data))
+    {
+      hash_move = HASH_MOVE (data);
+      if (ply > 0 && HASH_DEPTH (data) >= depth)
+	{
+	  value = HASH_SCORE (data);
+	  if (HASH_BOUND (data) == HASH_EXACT)
+	    return value;
+	  if (HASH_BOUND (data) == HASH_LOWER && value >= beta)
+	    return value;
+	  if (HASH_BOUND (data) == HASH_UPPER && value <= alpha)
+	    return value;
+	}
+    }
+
+  if (!in_check)
+    static_eval = Eval (pos, &search->pawn_hash);
+  pieces = POPCOUNT (pos->bb_color[pos->side] &
+		     ~pos->bb_piece[pos->side][PAWN] &
+		     ~pos->bb_piece[pos->side][KING]);
+
+  /* Reverse futility pruning: near the leaves, if we are so far above
+   * beta that not even a good move of the opponent would bring us back,
+   * we don't search any more */
+  if (engine->use_reverse_futility && !pv_node && !in_check && ply > 0 &&
+      depth <= 3 && beta > -MATE + MAX_PLY && beta < MATE - MAX_PLY &&
+      static_eval - REVERSE_FUTILITY_MARGIN * depth >= beta)
+    return static_eval - REVERSE_FUTILITY_MARGIN * depth;
+
+  /* Null move pruning: we let the opponent move twice in a row. If even
+   * then we are above beta, a real move would be even better, so a
+   * shallow search is enough to cut off here. Not when in check, nor two
+   * null moves in a row, nor with just pawns left, where passing would be
+   * the best move (zugzwang) */
+  if (engine->use_null_move && !pv_node && !in_check && ply > 0 &&
+      depth >= 3 && pieces > 0 && static_eval >= beta &&
+      beta < MATE - MAX_PLY && !search->null_verification &&
+      pos->hist[pos->hdp - 1].m != NO_MOVE)
+    {
+      reduction = depth > 6 ? 3 : 2;
+      MakeNullMove (pos);
+      value = -Search (search, -beta, -beta + 1, depth - 1 - reduction,
+		       &tmpMove);
+      TakeBackNullMove (pos);
+      if (engine->stop_search)
+	return 0;
+      if (value >= beta)
+	{
+	  /* Mates found after passing aren't to be trusted */
+	  if (value >= MATE - MAX_PLY)
+	    value = beta;
+
+	  /* With few pieces zugzwang is still possible, so we make sure
+	   * with a normal search, shallower and without null moves */
+	  if (pieces > 2)
+	    return value;
+	  search->null_verification = 1;
+	  value = Search (search, beta - 1, beta, depth - reduction, &tmpMove);
+	  search->null_verification = 0;
+	  if (engine->stop_search)
+	    return 0;
+	  if (value >= beta)
+	    return value;
+	}
+    }
+
+  /* The best move of a former search is likely to be the best one
+   * now, so we try it first, and then the rest of them. We loop through
+   * the posible moves and apply an alpha-beta search */
+  InitPicker (search, &picker, hash_move, PICK_ALL);
+  while ((m = NextMove (search, &picker)) != NO_MOVE)
+    {
+      /* Quiet moves tried late, after the hash move and the killers,
+       * which don't give check, are unlikely to be good */
+      late = !in_check && searched > 0 && m != hash_move &&
+	m != picker.killers[0] && m != picker.killers[1] &&
+	IsQuiet (pos, m) && !GivesCheck (pos, m);
+
+      if (!MakeMove (pos, m))
+	{
+	  /* If the current move isn't legal, we take it back
+	   * and take the next move in the list */
+	  TakeBack (pos);
+	  continue;
+	}
+      searched++;
+
+      /* Futility pruning: near the leaves, if we are so far below alpha
+       * that a quiet move won't bring us up there, we don't try it */
+      if (engine->use_futility && late && !pv_node && depth <= 3 &&
+	  alpha > -MATE + MAX_PLY &&
+	  static_eval + futility_margin[depth] <= alpha)
+	{
+	  TakeBack (pos);
+	  havemove = 1;
+	  if (static_eval + futility_margin[depth] > best)
+	    best = static_eval + futility_margin[depth];
+	  continue;
+	}
+
+      /* Late move reductions: we search the late moves less deep, and
+       * only if one of them turns out to be better than alpha we search
+       * it again to the full depth */
+      reduction = 0;
+      if (engine->use_lmr && late && depth >= 3 && searched > 3)
+	{
+	  reduction = (depth >= 6 && searched > 10) ? 2 : 1;
+	  if (depth - 1 - reduction < 1)
+	    reduction = depth - 2;
+	}
+
+      /* Principal Variation Search: the first move is likely to be the
+       * best one, so we search it with the whole window. For the rest we
+       * just want to prove they are worse, which is much faster with a
+       * null window around alpha. Only if one of them turns out to be
+       * better we have to search it again to know its real value */
+      if (depth - 1 > 0)
+	{
+	  if (!havemove)
+	    value = -Search (search, -beta, -alpha, depth - 1, &tmpMove);
+	  else
+	    {
+	      value = -Search (search, -alpha - 1, -alpha,
+			       depth - 1 - reduction, &tmpMove);
+	      if (value > alpha && reduction)
+		value = -Search (search, -alpha - 1, -alpha, depth - 1,
+				 &tmpMove);
+	      if (value > alpha && value < beta)
+		value = -Search (search, -beta, -alpha, depth - 1, &tmpMove);
+	    }
+	}
+      /* If no depth left (leaf node), we go on with the captures */
+      else
+	{
+	  if (!havemove)
+	    value = -Quiescent (search, -beta, -alpha, 0);
+	  else
+	    {
+	      value = -Quiescent (search, -alpha - 1, -alpha, 0);
+	      if (value > alpha && value < beta)
+		value = -Quiescent (search, -beta, -alpha, 0);
+	    }
+	}
+
+      /* If we've reached this far, then we have a move available */
+      havemove = 1;
+
+      /* We've evaluated the position, so we return to the previous position in such a way
+         that when we take the next move everything is in order */
+      TakeBack (pos);
+
+      /* Out of time: the value is useless, so we just go back to the root */
+      if (engine->stop_search)
+	return 0;
+
+      /* Fail-soft: we keep the best value even if it's out of the
+       * window, so the hash table gets a tighter bound */
+      if (value > best)
+	best = value;
+
+      /* Once we have an evaluation, we use it in in an alpha-beta search */
+      if (value > alpha)
+	{
+	  /* This move is so good and caused a cutoff */
+	  if (value >= beta)
+	    {
+	      if (IsQuiet (pos, m))
+		UpdateQuietCutoff (search, m, depth);
+	      HashStore (&engine->hash, pos, depth, value, HASH_LOWER, m);
+	      *pBestMove = m;
+	      return value;
+	    }
+	  alpha = value;
+	  /* So far, current move is the best reaction for current position */
+	  *pBestMove = m;
+
+	  /* And the principal variation is this move followed by the one
+	   * of the position it leads to */
+	  search->pv[ply][0] = m;
+	  search->pv_length[ply] = 1;
+	  if (depth - 1 > 0)
+	    {
+	      for (i = 0; i < search->pv_length[ply + 1]; i++)
+		search->pv[ply][i + 1] = search->pv[ply + 1][i];
+	      search->pv_length[ply] += search->pv_length[ply + 1];
+	    }
+	}
+    }
+
+  /* Once we've checked all the moves, if we have no legal moves,
+   * then that's checkmate or stalemate */
+  if (!havemove)
+    {
+      if (IsInCheck (pos, pos->side))
+	best = -MATE + ply;	/* add ply to find the longest path to lose or shortest path to win */
+      else
+	best = 0;
+      HashStore (&engine->hash, pos, depth, best, HASH_EXACT, *pBestMove);
+      return best;
+    }
+
+  /* Finally we return the best value */
+  HashStore (&engine->hash, pos, depth, best,
+	     best > old_alpha ? HASH_EXACT : HASH_UPPER, *pBestMove);
+  return best;
+}
+
+#define DELTA_MARGIN 200	/* What the position may gain besides the capture */
+
+int
+Quiescent (SEARCH * search, int alpha, int beta, int qdepth)
+{
+  POSITION *pos = &search->pos;
+  int stand_pat = 0;
+  int score;
+  int best;			/* Fail-soft, as Search */
+  int captured;
+  int in_check;
+  MOVEPICKER picker;
+  MOVE m;
+
+  PROF_COUNT (pos, PROF_QUIESCENT);
+  search->nodes++;
+  if ((search->nodes & 1023) == 0)
+    CheckTime (search);
 
-  piece[m.dest] = piece[m.from];	/* dest piece is the one in the original square */
-  color[m.dest] = color[m.from];	/* The dest square color is the one of the origin piece */
-  piece[m.from] = EMPTY;	/* The original square becomes empty */
-  color[m.from] = EMPTY;	/* The original color becomes empty */
+  if (pos->ply >= MAX_PLY - 1)
+    return Eval (pos, &search->pawn_hash);
 
-  /* en pasant capture */
-  if (m.type == MOVE_TYPE_EPS)
+  in_check = IsInCheck (pos, pos->side);
+  if (in_check)
     {
-      if (side == WHITE)
-	{
-	  piece[m.dest + 8] = EMPTY;
-	  color[m.dest + 8] = EMPTY;
-	}
-      else
-	{
-	  piece[m.dest - 8] = EMPTY;
-	  color[m.dest - 8] = EMPTY;
-	}
+      /* In check doing nothing isn't an option, so there's no stand pat:
+       * we try all the evasions, and if there isn't any it's mate */
+      best = -MATE + pos->ply;
+      InitPicker (search, &picker, NO_MOVE, PICK_ALL);
     }
-
-  /* Remove possible eps piece, remaining from former move */
-  if (hist[hdp - 1].m.type == MOVE_TYPE_PAWN_TWO)
+  else
     {
-      for (i = 16; i <= 23; i++)
-	{
-	  if (piece[i] == EPS_SQUARE)
-	    {
-	      piece[i] = EMPTY;
-	      /* this seems unnecesary, but otherwise a bug occurs:
-	       * after: a3 Nc6 d4 e6, white isn't allowed to play e4 */
-//                color[i] = EMPTY;
-	      break;
-	    }
-	}
-      for (i = 40; i <= 47; i++)
-	{
-	  if (piece[i] == EPS_SQUARE)
-	    {
-	      piece[i] = EMPTY;
-//                              color[i] = EMPTY;
-	      break;
-	    }
-	}
+      /* First we just try the evaluation function */
+      stand_pat = Eval (pos, &search->pawn_hash);
+      if (stand_pat >= beta)
+	return stand_pat;
+      if (alpha < stand_pat)
+	alpha = stand_pat;
+      best = stand_pat;
+
+      /* If we haven't got a cut off we try the captures, the picker
+       * generates them and gives us the best ones first. In the first
+       * ply also the quiet checks, to see the simple mating attacks */
+      InitPicker (search, &picker, NO_MOVE,
+		  qdepth == 0 ? PICK_CHECKS : PICK_CAPTURES);
     }
 
-  /* Add the eps square when a pawn moves two squares */
-  if (m.type == MOVE_TYPE_PAWN_TWO)
+  while ((m = NextMove (search, &picker)) != NO_MOVE)
     {
-      if (side == BLACK)
+      /* A quiet check which loses the piece isn't worth it either */
+      if (!in_check && IsQuiet (pos, m))
 	{
-	  piece[m.from + 8] = EPS_SQUARE;
-	  color[m.from + 8] = EMPTY;
+	  if (See (pos, m) < 0)
+	    continue;
 	}
-      else if (side == WHITE)
+      /* Promotions are always worth a try */
+      else if (!in_check && MOVE_TYPE (m) < MOVE_TYPE_PROMOTION_TO_QUEEN)
 	{
-	  piece[m.from - 8] = EPS_SQUARE;
-	  color[m.from - 8] = EMPTY;
+	  if (MOVE_TYPE (m) == MOVE_TYPE_EPS)
+	    captured = PAWN;
+	  else
+	    captured = pos->piece[MOVE_DEST (m)];
+
+	  /* Delta pruning: even winning the piece for free, and something
+	   * more, we wouldn't reach alpha */
+	  if (stand_pat + value_piece[captured] + DELTA_MARGIN <= alpha)
+	    continue;
+
+	  /* A capture that loses material, v.g. QxP defended by a pawn.
+	   * Taking a piece worth as much as ours can't lose anything */
+	  if (value_piece[pos->piece[MOVE_FROM (m)]] > value_piece[captured]
+	      && See (pos, m) < 0)
+	    continue;
 	}
-    }
 
-  /* Once the move is done we check either this is a promotion */
-  if (m.type >= MOVE_TYPE_PROMOTION_TO_QUEEN)
-    {
-      /* In this case we put in the destiny sq the chosen piece */
-      switch (m.type)
+      if (!MakeMove (pos, m))
 	{
-	case MOVE_TYPE_PROMOTION_TO_QUEEN:
-	  piece[m.dest] = QUEEN;
-	  break;
+	  /* If the current move isn't legal, we take it back
+	   * and take the next move in the list */
+	  TakeBack (pos);
+	  continue;
+	}
+      score = -Quiescent (search, -beta, -alpha, qdepth - 1);
+      TakeBack (pos);
+      if (search->engine->stop_search)
+	return 0;
+      if (score > best)
+	best = score;
+      if (score >= beta)
+	return score;
+      if (score > alpha)
+	alpha = score;
+    }
+  return best;
+}
 
-	case MOVE_TYPE_PROMOTION_TO_ROOK:
-	  piece[m.dest] = ROOK;
-	  break;
 
-	case MOVE_TYPE_PROMOTION_TO_BISHOP:
-	  piece[m.dest] = BISHOP;
-	  break;
 
-	case MOVE_TYPE_PROMOTION_TO_KNIGHT:
-	  piece[m.dest] = KNIGHT;
-	  break;
+/*
+ ****************************************************************************
+ * Threads *
+ ****************************************************************************
+ */
+/* Lazy SMP: all the threads search the same position at the same time, each
+ * one on its own board, and they only share the hash table. What a thread
+ * finds is stored there and saves work to the others, so the main thread
+ * reaches higher depths. Half the helpers search one ply deeper, so the
+ * threads don't always walk the same tree in the same order */
 
-	default:
-	  puts ("Impossible to get here...");
-	  assert (false);
-	}
+/* Set the number of threads, between 1 and MAX_THREADS */
+void
+SetThreads (ENGINE * engine, int n)
+{
+  SEARCH *threads;
+
+  if (n < 1)
+    n = 1;
+  if (n > MAX_THREADS)
+    n = MAX_THREADS;
+  threads = realloc (engine->threads, n * sizeof (SEARCH));
+  if (!threads)
+    {
+      puts ("Not enough memory for the threads");
+      return;
     }
+  /* The new threads start with an empty pawn hash */
+  if (n > engine->num_threads)
+    memset (threads + engine->num_threads, 0,
+	    (n - engine->num_threads) * sizeof (SEARCH));
+  engine->threads = threads;
+  engine->num_threads = n;
+}
+
+/* Copy a position to another one, v.g. the game to the board of a search
+ * thread. Only the moves played so far are copied from the history */
+void
+CopyPosition (POSITION * dst, POSITION * src)
+{
+  memcpy (dst, src, sizeof (POSITION) - sizeof (src->hist));
+  memcpy (dst->hist, src->hist, src->hdp * sizeof (HIST));
+}
+
+#define ASPIRATION_WINDOW 40	/* Centipawns at each side of the former score */
+#define ASPIRATION_MAX 400	/* Wider than this, we search with all of it */
 
-  if (m.type == MOVE_TYPE_CASTLE)
+/* Iterative deepening: search to depth 1, then 2... until depth or until
+ * the time is over. Each iteration is faster thanks to the moves stored in
+ * the hash table by the former one */
+void
+IterativeDeepening (SEARCH * search)
+{
+  POSITION *pos = &search->pos;
+  ENGINE *engine = search->engine;
+  MOVE m;
+  int score;
+  int alpha;
+  int beta;
+  int delta;			/* Half the width of the aspiration window */
+  int i;
+  char move_str[6];
+
+  pos->ply = 0;
+#ifdef PROFILE
+  memset (&pos->prof, 0, sizeof (pos->prof));
+#endif
+  search->nodes = 0;
+  search->best = NO_MOVE;
+  memset (search->killers, 0, sizeof (search->killers));
+  memset (search->history, 0, sizeof (search->history));
+  search->pawn_hash.probes = 0;
+  search->pawn_hash.hits = 0;
+  search->best_depth = 0;
+  search->null_verification = 0;
+
+  for (search->search_depth = 1 + (search->id & 1);
+       search->search_depth <= search->depth; search->search_depth++)
     {
-      if (m.dest == G1)
+      /* Aspiration windows: the score is likely to be close to the one of
+       * the former iteration, so we search with a narrow window around it,
+       * where much more is pruned. If the score falls out of the window we
+       * search again with a wider one on that side */
+      delta = ASPIRATION_WINDOW;
+      if (search->best_depth >= 4 && search->best_score > -MATE + MAX_PLY
+	  && search->best_score < MATE - MAX_PLY)
 	{
-	  /* h1-h8 becomes empty */
-	  piece[m.from + 3] = EMPTY;
-	  color[m.from + 3] = EMPTY;
-	  /* rook to f1-f8 */
-	  piece[m.from + 1] = ROOK;
-	  color[m.from + 1] = WHITE;
+	  alpha = search->best_score - delta;
+	  beta = search->best_score + delta;
 	}
-      else if (m.dest == C1)
+      else
 	{
-	  /* h1-h8 becomes empty */
-	  piece[m.from - 4] = EMPTY;
-	  color[m.from - 4] = EMPTY;
-	  /* rook to f1-f8 */
-	  piece[m.from - 1] = ROOK;
-	  color[m.from - 1] = WHITE;
+	  alpha = -MATE;
+	  beta = MATE;
 	}
-      else if (m.dest == G8)
+
+      for (;;)
 	{
-	  /* h1-h8 becomes empty */
-	  piece[m.from + 3] = EMPTY;
-	  color[m.from + 3] = EMPTY;
-	  /* rook to f1-f8 */
-	  piece[m.from + 1] = ROOK;
-	  color[m.from + 1] = BLACK;
+	  score = Search (search, alpha, beta, search->search_depth, &m);
+	  if (engine->stop_search)
+	    break;
+	  /* With the whole window there is nothing to widen */
+	  if ((score > alpha && score < beta) ||
+	      (alpha == -MATE && beta == MATE))
+	    break;
+
+	  if (engine->post && search->id == 0)
+	    {
+	      printf ("%d %d %lld %llu", search->search_depth, score,
+		      (GetTime () - engine->search_start) / 10,
+		      search->nodes);
+	      if (score >= beta)
+		{
+		  MoveToString (m, move_str);
+		  printf (" %s! (fail high)\n", move_str);
+		}
+	      else
+		printf (" (fail low)\n");
+	    }
+
+	  /* Each time the window grows faster, and past some point we
+	   * don't bother any more */
+	  delta *= 2;
+	  if (delta > ASPIRATION_MAX)
+	    {
+	      alpha = -MATE;
+	      beta = MATE;
+	    }
+	  else if (score >= beta)
+	    beta = score + delta < MATE ? score + delta : MATE;
+	  else
+	    alpha = score - delta > -MATE ? score - delta : -MATE;
 	}
-      else if (m.dest == C8)
+
+      /* An unfinished iteration doesn't tell us anything */
+      if (engine->stop_search)
+	break;
+      search->best = m;
+      search->best_score = score;
+      search->best_depth = search->search_depth;
+
+      /* The helpers just keep on searching until they are told to stop */
+      if (search->id != 0)
+	continue;
+
+      /* Thinking output, as xboard likes it: ply score time nodes pv */
+      if (engine->post)
 	{
-	  /* h1-h8 becomes empty */
-	  piece[m.from - 4] = EMPTY;
-	  color[m.from - 4] = EMPTY;
-	  /* rook to f1-f8 */
-	  piece[m.from - 1] = ROOK;
-	  color[m.from - 1] = BLACK;
+	  printf ("%d %d %lld %llu", search->search_depth, score,
+		  (GetTime () - engine->search_start) / 10, search->nodes);
+	  for (i = 0; i < search->pv_length[0]; i++)
+	    {
+	      MoveToString (search->pv[0][i], move_str);
+	      printf (" %s", move_str);
+	    }
+	  printf ("\n");
 	}
-    }
 
-  /* Update ply and hdp */
-  ply++;
-  hdp++;
-
-  /* Update the castle rights */
-  castle_rights &= castle_mask[m.from] & castle_mask[m.dest];
+      /* Not enough time left to finish another iteration: the next
+       * one takes longer than all the former ones together */
+      if (engine->time_soft != -1 &&
+	  GetTime () - engine->search_start >= engine->time_soft / 2)
+	break;
+    }
+}
 
-  /* Checking if after making the move we're in check */
-  r = !IsInCheck (side);
+void *
+HelperThread (void *arg)
+{
+  IterativeDeepening ((SEARCH *) arg);
+  return NULL;
+}
 
-  /* After making move, give turn to opponent */
-  side = (WHITE + BLACK) - side;
+#ifdef PROFILE
+char *prof_names[PROF_FUNCTIONS] = {
+  "GenMoves", "GenCaps", "GenQuiets", "Eval", "MakeMove", "TakeBack",
+  "IsAttacked", "Quiescent"
+};
 
-  return r;
+/* Add the counters of the threads of the last search to prof */
+void
+AddProfile (PROFDATA * prof, ENGINE * engine)
+{
+  int i;
+  int f;
+  for (i = 0; i < engine->num_threads; i++)
+    for (f = 0; f < PROF_FUNCTIONS; f++)
+      {
+	prof->calls[f] += engine->threads[i].pos.prof.calls[f];
+	prof->cycles[f] += engine->threads[i].pos.prof.cycles[f];
+      }
 }
 
-/* Undo what MakeMove did */
+/* The table of the calls. The cycles of a function include the ones of
+ * the functions it calls, vg MakeMove includes IsAttacked */
 void
-TakeBack ()
+PrintProfile (PROFDATA * prof)
 {
+  int f;
+  printf (" %-12s %14s %16s %12s\n", "function", "calls", "cycles",
+	  "cycles/call");
+  for (f = 0; f < PROF_FUNCTIONS; f++)
+    {
+      if (prof->cycles[f] == 0)
+	printf (" %-12s %14llu %16s %12s\n", prof_names[f], prof->calls[f],
+		"-", "-");
+      else
+	printf (" %-12s %14llu %16llu %12.1f\n", prof_names[f],
+		prof->calls[f], prof->cycles[f],
+		(double) prof->cycles[f] / prof->calls[f]);
+    }
+}
+#endif
 
+/* Search the game position and return the best move, and its score in
+ * pScore if it isn't NULL */
+MOVE
+ComputerThink (ENGINE * engine, int depth, int *pScore)
+{
+  /* It returns the move the computer makes */
+  MOVE m;
+  int score;
   int i;
+  SEARCH *t;
+  SEARCH *best;			/* The thread whose move we play */
+  double knps;
+  unsigned long long nodes = 0;
+  unsigned long long pawn_probes = 0;
+  unsigned long long pawn_hits = 0;
+  char move_str[6];
 
-  side = (WHITE + BLACK) - side;
-  hdp--;
-  ply--;
-  piece[hist[hdp].m.from] = piece[hist[hdp].m.dest];
-  piece[hist[hdp].m.dest] = hist[hdp].cap;
-  color[hist[hdp].m.from] = side;
+  /* With no iteration at all there would be no move, as if it were mate */
+  if (depth < 1)
+    depth = 1;
 
-  /* Update castle rights */
-  castle_rights = hist[hdp].castle;
+  /* Reset some values before searching */
+  /* Former entries get older */
+  engine->hash.age = (engine->hash.age + 1) & 0x3F;
+  engine->stop_search = 0;
 
-  /* Return the captured material */
-  if (hist[hdp].cap != EMPTY && hist[hdp].cap != EPS_SQUARE)
-    {
-      color[hist[hdp].m.dest] = (WHITE + BLACK) - side;
-    }
-  else
-    {
-      color[hist[hdp].m.dest] = EMPTY;
-    }
+  double time = 0.0;
 
-  /* Promotion */
-  if (hist[hdp].m.type >= MOVE_TYPE_PROMOTION_TO_QUEEN)
-    {
-      piece[hist[hdp].m.from] = PAWN;
-    }
+  /* Start timer */
+  SetTimeLimits (engine);
 
-  /* If pawn moved two squares in the former move, we have to restore
-   * the eps square */
-  if (hist[hdp - 1].m.type == MOVE_TYPE_PAWN_TWO)
+  /* Start the helpers, and then the main thread searches too */
+  for (i = 0; i < engine->num_threads; i++)
     {
-      if (side == WHITE)
-	{
-	  piece[hist[hdp - 1].m.dest - 8] = EPS_SQUARE;
-//            color[hist[hdp-1].m.dest - 8] = EMPTY;
-	}
-      else if (side == BLACK)
+      t = &engine->threads[i];
+      CopyPosition (&t->pos, &engine->pos);
+      t->engine = engine;
+      t->id = i;
+      /* Deeper than MAX_PLY the killers and the pv wouldn't fit */
+      t->depth = depth < MAX_PLY - 2 ? depth : MAX_PLY - 2;
+      t->best_depth = 0;
+      if (i > 0 && pthread_create (&t->handle, NULL, HelperThread, t))
 	{
-	  piece[hist[hdp - 1].m.dest + 8] = EPS_SQUARE;
-//            color[hist[hdp-1].m.dest + 8] = EMPTY;
+	  printf ("Could not start thread %d\n", i);
+	  engine->num_threads = i;
 	}
     }
+  IterativeDeepening (&engine->threads[0]);
 
-  /* To remove the eps square after unmaking a pawn
-   * moving two squares*/
-  if (hist[hdp].m.type == MOVE_TYPE_PAWN_TWO)
+  /* The main thread is done, so are the helpers */
+  engine->stop_search = 1;
+  best = &engine->threads[0];
+  for (i = 0; i < engine->num_threads; i++)
     {
-      if (side == WHITE)
-	{
-	  piece[hist[hdp].m.from - 8] = EMPTY;
-	  color[hist[hdp].m.from - 8] = EMPTY;
-	}
-      else
-	{
-	  piece[hist[hdp].m.from + 8] = EMPTY;
-	  color[hist[hdp].m.from + 8] = EMPTY;
-	}
+      t = &engine->threads[i];
+      if (i > 0)
+	pthread_join (t->handle, NULL);
+      nodes += t->nodes;
+      pawn_probes += t->pawn_hash.probes;
+      pawn_hits += t->pawn_hash.hits;
+
+      /* The deepest search is the most reliable, and for the same
+       * depth the best score */
+      if (t->best_depth > best->best_depth ||
+	  (t->best_depth == best->best_depth &&
+	   t->best_score > best->best_score))
+	best = t;
     }
+  m = best->best;
+  score = best->best_score;
+  if (pScore)
+    *pScore = score;
 
-  /* Unmaking an en pasant capture */
-  if (hist[hdp].m.type == MOVE_TYPE_EPS)
-    {
-      if (side == WHITE)
-	{
-	  /* The pawn */
-	  piece[hist[hdp].m.dest + 8] = PAWN;
-	  color[hist[hdp].m.dest + 8] = BLACK;
-	  /* The eps square */
-	  piece[hist[hdp].m.dest] = EPS_SQUARE;
-//            color[hist[hdp].m.dest] = EMPTY;
-	}
-      else
-	{
-	  /* The pawn */
-	  piece[hist[hdp].m.dest - 8] = PAWN;
-	  color[hist[hdp].m.dest - 8] = WHITE;
-	  /* The eps square */
-	  piece[hist[hdp].m.dest] = EPS_SQUARE;
-//            color[hist[hdp].m.dest] = EMPTY;
-	}
-    }
+  if (!engine->post)
+    return m;
 
-  /* Undo Castle: return rook to its original square */
-  if (hist[hdp].m.type == MOVE_TYPE_CASTLE)
+  /* Stop timer */
+  time = (double) (GetTime () - engine->search_start) / 1000.;
+  if (time <= 0)
+    time = 0.001;
+  knps = ((double) nodes / time) / 1000.;
+
+  double decimal_score = ((double) score) / 100.;
+  if (engine->pos.side == BLACK)
     {
-      /* Take the tower to its poriginal place */
-      if (hist[hdp].m.dest == G1 && side == WHITE)
-	{
-	  piece[H1] = ROOK;
-	  color[H1] = WHITE;
-	  piece[F1] = EMPTY;
-	  color[F1] = EMPTY;
-	}
-      else if (hist[hdp].m.dest == C1 && side == WHITE)
-	{
-	  piece[A1] = ROOK;
-	  color[A1] = WHITE;
-	  piece[D1] = EMPTY;
-	  color[D1] = EMPTY;
-	}
-      else if (hist[hdp].m.dest == G8 && side == BLACK)
-	{
-	  piece[H8] = ROOK;
-	  color[H8] = BLACK;
-	  piece[F8] = EMPTY;
-	  color[F8] = EMPTY;
-	}
-      else if (hist[hdp].m.dest == C8 && side == BLACK)
-	{
-	  piece[A8] = ROOK;
-	  color[A8] = BLACK;
-	  piece[D8] = EMPTY;
-	  color[D8] = EMPTY;
-	}
+      decimal_score = -decimal_score;
     }
+
+  /* After searching, print results */
+  if (m == NO_MOVE)
+    strcpy (move_str, "none");
+  else
+    MoveToString (m, move_str);
+  printf
+    ("Search result: move = %s; depth = %d, score = %.2f, time = %.2fs knps = %.2f\n nodes = %llu\n",
+     move_str, best->best_depth, decimal_score, time, knps, nodes);
+  if (pawn_probes)
+    printf (" pawn hash hits = %.1f%%\n", 100. * pawn_hits / pawn_probes);
+#ifdef PROFILE
+  {
+    PROFDATA prof;
+    memset (&prof, 0, sizeof (prof));
+    AddProfile (&prof, engine);
+    PrintProfile (&prof);
+  }
+#endif
+  return m;
 }
 
 /*
  ****************************************************************************
- * Search function - a typical alphabeta, main search function *
- * Lack: no move ordering *
+ * Engine API *
  ****************************************************************************
  */
+/* See secondchess.h */
 
-int
-Search (int alpha, int beta, int depth, MOVE * pBestMove)
+/* Set up the board with the pieces of a given position */
+void
+SetPosition (POSITION * pos, const int piece[64], const int color[64],
+	     int side, int castle_rights, int eps_square)
 {
   int i;
-  int value;			/* To store the evaluation */
-  int havemove;			/* Either we have or not a legal move available */
-  int movecnt;			/* The number of available moves */
 
-  MOVE moveBuf[200];		/* List of movements */
-  MOVE tmpMove;
+  /* Empty the board and then put every piece in its place */
+  memset (pos->bb_piece, 0, sizeof (pos->bb_piece));
+  memset (pos->bb_color, 0, sizeof (pos->bb_color));
+  pos->bb_all = 0;
+  pos->king_sq[WHITE] = -1;	/* AddPiece puts them */
+  pos->king_sq[BLACK] = -1;
+  pos->score_mg = 0;
+  pos->score_eg = 0;
+  pos->phase = 0;
+  pos->pawn_key = 0;
+  for (i = 0; i < 64; ++i)
+    {
+      pos->piece[i] = EMPTY;
+      pos->color[i] = EMPTY;
+      if (piece[i] != EMPTY)
+	AddPiece (pos, i, color[i], piece[i]);
+    }
 
-  // nodes++; /* visiting a node, count it */
-  havemove = 0;			/* is there a move available? */
-  pBestMove->type = MOVE_TYPE_NONE;
+  pos->side = side;
+  pos->castle_rights = castle_rights;
+  pos->eps_square = eps_square;
+  pos->hdp = 0;
+  pos->ply = 0;
+  pos->hash_key = HashKey (pos);
+#ifdef PROFILE
+  memset (&pos->prof, 0, sizeof (pos->prof));
+#endif
+}
 
-  /* Generate and count all moves for current position */
-  movecnt = GenMoves (side, moveBuf);
-  assert (movecnt < 201);
+/* SetPosition for a board which comes from outside, a FEN or the API.
+ * Returns 0, and doesn't change pos, if the position can't be played:
+ * not one king of each color, pawns in the first or the last rank, or
+ * the side which has just moved in check. Castle rights and an eps
+ * square which don't fit the board are left out, otherwise the move
+ * generator would move pieces which aren't there */
+int
+SetValidPosition (POSITION * pos, const int piece[64], const int color[64],
+		  int side, int castle_rights, int eps_square)
+{
+  int kings[2] = { 0, 0 };
+  int sq;
+  int pawn_sq;
+  int from_sq;
+  POSITION *tmp;
+
+  if (side != WHITE && side != BLACK)
+    return 0;
+  for (sq = 0; sq < 64; sq++)
+    {
+      if (piece[sq] == EMPTY)
+	continue;
+      if (piece[sq] < PAWN || piece[sq] > KING ||
+	  (color[sq] != WHITE && color[sq] != BLACK))
+	return 0;
+      if (piece[sq] == KING)
+	kings[color[sq]]++;
+      /* Pawns never stand in the first or the last rank */
+      if (piece[sq] == PAWN && (ROW (sq) == 0 || ROW (sq) == 7))
+	return 0;
+    }
+  if (kings[WHITE] != 1 || kings[BLACK] != 1)
+    return 0;
+
+  /* A castle right needs the king and the rook in their squares */
+  castle_rights &= 15;
+  if (piece[E1] != KING || color[E1] != WHITE)
+    castle_rights &= ~3;
+  if (piece[H1] != ROOK || color[H1] != WHITE)
+    castle_rights &= ~1;
+  if (piece[A1] != ROOK || color[A1] != WHITE)
+    castle_rights &= ~2;
+  if (piece[E8] != KING || color[E8] != BLACK)
+    castle_rights &= ~12;
+  if (piece[H8] != ROOK || color[H8] != BLACK)
+    castle_rights &= ~4;
+  if (piece[A8] != ROOK || color[A8] != BLACK)
+    castle_rights &= ~8;
+
+  /* The eps square needs an enemy pawn in front of it, seen from the side
+   * to move, which came from the square behind, empty now */
+  if (eps_square < 0 || eps_square > 63)
+    eps_square = -1;
+  if (eps_square != -1)
+    {
+      pawn_sq = (side == WHITE) ? eps_square + 8 : eps_square - 8;
+      from_sq = (side == WHITE) ? eps_square - 8 : eps_square + 8;
+      if (ROW (eps_square) != ((side == WHITE) ? 2 : 5) ||
+	  piece[eps_square] != EMPTY || piece[from_sq] != EMPTY ||
+	  piece[pawn_sq] != PAWN || color[pawn_sq] == side)
+	eps_square = -1;
+    }
 
-  /* Once we have all the moves available, we loop through the posible
-   * moves and apply an alpha-beta search */
-  for (i = 0; i < movecnt; ++i)
+  /* The side which has just moved can't be in check. We try it in a
+   * position of our own, so pos isn't changed if it's wrong */
+  tmp = malloc (sizeof (POSITION));
+  if (!tmp)
+    return 0;
+  SetPosition (tmp, piece, color, side, castle_rights, eps_square);
+  if (IsInCheck (tmp, (WHITE + BLACK) - side))
     {
+      free (tmp);
+      return 0;
+    }
+  CopyPosition (pos, tmp);
+  free (tmp);
+  return 1;
+}
 
-      if (!MakeMove (moveBuf[i]))
-	{
-	  /* If the current move isn't legal, we take it back
-	   * and take the next move in the list */
-	  TakeBack ();
-	  continue;
-	}
+void
+StartPosition (POSITION * pos)
+{
+  SetPosition (pos, init_piece, init_color, WHITE, 15, -1);
+}
 
-      /* If we've reached this far, then we have a move available */
-      havemove = 1;
+/* Set up the position of a FEN string, v.g. the start position is
+ * "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1". The move
+ * counters at the end may be missing, we don't use them. Returns 0 if the
+ * FEN isn't right, and then the position isn't changed. The board is
+ * checked as in SetValidPosition */
+int
+SetFen (POSITION * pos, const char *fen)
+{
+  const char *names = "pnbrqk";
+  const char *p;
+  int piece[64];
+  int color[64];
+  int rank = 0;			/* 0 is the 8th rank, as in our squares */
+  int file = 0;
+  int side;
+  int castle_rights = 0;
+  int eps_square = -1;
+  int i;
 
-      /* This 'if' takes us to the deep of the position, the leaf nodes */
-      if (depth - 1 > 0)
+  for (i = 0; i < 64; i++)
+    {
+      piece[i] = EMPTY;
+      color[i] = EMPTY;
+    }
+
+  /* The board, from a8 to h1 as our squares. Each rank has to have its
+   * 8 squares, or the pieces would end up in the next one */
+  while (*fen && *fen <= ' ')
+    fen++;
+  for (; *fen > ' '; fen++)
+    {
+      if (*fen == '/')
 	{
-	  value = -Search (-beta, -alpha, depth - 1, &tmpMove);
+	  if (file != 8 || rank == 7)
+	    return 0;
+	  rank++;
+	  file = 0;
 	}
-      /* If no depth left (leaf node), we evalute the position
-         and apply the alpha-beta search.
-         In the case of existing a quiescent function, it should be
-         called here instead of Eval() */
-      else
+      else if (*fen >= '1' && *fen <= '8')
 	{
-	  value = -Quiescent (-beta, -alpha);
-	  // value = -Eval();
+	  file += *fen - '0';
+	  if (file > 8)
+	    return 0;
 	}
-
-      /* We've evaluated the position, so we return to the previous position in such a way
-         that when we take the next move from moveBuf everything is in order */
-      TakeBack ();
-
-      /* Once we have an evaluation, we use it in in an alpha-beta search */
-      if (value > alpha)
+      else if ((p = strchr (names, *fen | 32)) != NULL && file < 8)
 	{
-	  /* This move is so good and caused a cutoff */
-	  if (value >= beta)
-	    {
-	      return beta;
-	    }
-	  alpha = value;
-	  /* So far, current move is the best reaction for current position */
-	  *pBestMove = moveBuf[i];
+	  piece[rank * 8 + file] = p - names;
+	  color[rank * 8 + file] = (*fen >= 'a') ? BLACK : WHITE;
+	  file++;
 	}
+      else
+	return 0;
     }
+  if (rank != 7 || file != 8)
+    return 0;
+
+  /* Side to move */
+  while (*fen && *fen <= ' ')
+    fen++;
+  if (*fen == 'w')
+    side = WHITE;
+  else if (*fen == 'b')
+    side = BLACK;
+  else
+    return 0;
+  fen++;
 
-  /* Once we've checked all the moves, if we have no legal moves,
-   * then that's checkmate or stalemate */
-  if (!havemove)
+  /* Castle rights, with our bits */
+  while (*fen && *fen <= ' ')
+    fen++;
+  for (; *fen > ' '; fen++)
     {
-      if (IsInCheck (side))
-	return -MATE + ply;	/* add ply to find the longest path to lose or shortest path to win */
-      else
+      if (*fen == 'K')
+	castle_rights |= 1;
+      else if (*fen == 'Q')
+	castle_rights |= 2;
+      else if (*fen == 'k')
+	castle_rights |= 4;
+      else if (*fen == 'q')
+	castle_rights |= 8;
+      else if (*fen != '-')
 	return 0;
     }
 
-  /* Finally we return alpha, the score value */
-  return alpha;
-}
-
-int
-Quiescent (int alpha, int beta)
-{
-  int i;
-  int capscnt;
-  int stand_pat;
-  int score;
-  MOVE cBuf[200];
+  /* The eps square, the one the pawn has jumped over */
+  while (*fen && *fen <= ' ')
+    fen++;
+  if (*fen >= 'a' && *fen <= 'h' && fen[1] >= '1' && fen[1] <= '8')
+    eps_square = (fen[0] - 'a') + 8 * (8 - (fen[1] - '0'));
+  else if (*fen > ' ' && *fen != '-')
+    return 0;
 
-  count_quies_calls++;
+  return SetValidPosition (pos, piece, color, side, castle_rights,
+			   eps_square);
+}
 
-  /* First we just try the evaluation function */
-  stand_pat = Eval ();
-  if (stand_pat >= beta)
-    return beta;
-  if (alpha < stand_pat)
-    alpha = stand_pat;
+/* The tables of the bitboards and the hash keys are the same for all the
+ * engines, they are calculated the first time one is created */
+pthread_once_t init_once = PTHREAD_ONCE_INIT;
 
-  /* If we haven't got a cut off we generate the captures and
-   * store them in cBuf */
-  capscnt = GenCaps (side, cBuf);
+void
+InitTables ()
+{
+  InitBitboards ();
+  InitHash ();
+  InitEval ();
+}
 
-  count_cap_calls++;
+ENGINE *
+EngineCreate (int hash_mb)
+{
+  ENGINE *engine;
 
-  for (i = 0; i < capscnt; ++i)
+  pthread_once (&init_once, InitTables);
+  engine = calloc (1, sizeof (ENGINE));
+  if (!engine)
+    return NULL;
+  if (!HashAlloc (&engine->hash, hash_mb))
     {
-      if (!MakeMove (cBuf[i]))
-	{
-	  /* If the current move isn't legal, we take it back
-	   * and take the next move in the list */
-	  TakeBack ();
-	  continue;
-	}
-      score = -Quiescent (-beta, -alpha);
-      TakeBack ();
-      if (score >= beta)
-	return beta;
-      if (score > alpha)
-	alpha = score;
+      EngineDestroy (engine);
+      return NULL;
+    }
+  SetThreads (engine, 1);
+  if (!engine->threads)
+    {
+      EngineDestroy (engine);
+      return NULL;
     }
-  return alpha;
+  engine->time_left = -1;
+  engine->time_per_move = -1;
+  engine->use_null_move = 1;
+  engine->use_lmr = 1;
+  engine->use_futility = 1;
+  engine->use_reverse_futility = 1;
+  StartPosition (&engine->pos);
+  return engine;
 }
 
-
-
-MOVE
-ComputerThink (int depth)
+void
+EngineDestroy (ENGINE * engine)
 {
-  /* It returns the move the computer makes */
-  MOVE m;
-  int score;
-  double knps;
-
-  /* Reset some values before searching */
-  ply = 0;
-  nodes = 0;
-  count_evaluations = 0;
-  count_MakeMove = 0;
-  count_quies_calls = 0;
-  count_cap_calls = 0;
+  if (!engine)
+    return;
+  free (engine->hash.memory);
+  free (engine->perft_hash.entries);
+  free (engine->threads);
+  free (engine);
+}
 
-  clock_t start;
-  clock_t stop;
-  double t = 0.0;
+void
+EngineSetThreads (ENGINE * engine, int threads)
+{
+  SetThreads (engine, threads);
+}
 
-  /* Start timer */
-  start = clock ();
-  assert (start != -1);
+int
+EngineSetOption (ENGINE * engine, const char *name, int value)
+{
+  if (!strcmp (name, "NullMove"))
+    engine->use_null_move = value;
+  else if (!strcmp (name, "LMR"))
+    engine->use_lmr = value;
+  else if (!strcmp (name, "Futility"))
+    engine->use_futility = value;
+  else if (!strcmp (name, "ReverseFutility"))
+    engine->use_reverse_futility = value;
+  else
+    return 0;
+  return 1;
+}
 
-  /* Search now */
-  score = Search (-MATE, MATE, depth, &m);
+int
+EngineSetPosition (ENGINE * engine, const int piece[64], const int color[64],
+		   int side, int castle_rights, int eps_square)
+{
+  return SetValidPosition (&engine->pos, piece, color, side, castle_rights,
+			   eps_square);
+}
 
-  /* Stop timer */
-  stop = clock ();
-  t = (double) (stop - start) / CLOCKS_PER_SEC;
-  knps = ((double) count_quies_calls / t) / 1000.;
+int
+EngineSetFen (ENGINE * engine, const char *fen)
+{
+  return SetFen (&engine->pos, fen);
+}
 
-  double ratio_Qsearc_Capcalls =
-    (double) count_quies_calls / (double) count_cap_calls;
+int
+EngineMakeMove (ENGINE * engine, const char *move)
+{
+  POSITION *pos = &engine->pos;
+  MOVE moveBuf[MAX_MOVES];
+  int movecnt;
+  int from, dest, type;
+  int i;
 
-  double decimal_score = ((double) score) / 100.;
-  if (side == BLACK)
+  if (strlen (move) < 4 ||
+      move[0] < 'a' || move[0] > 'h' || move[1] < '1' || move[1] > '8' ||
+      move[2] < 'a' || move[2] > 'h' || move[3] < '1' || move[3] > '8')
+    return 0;
+  from = move[0] - 'a' + 8 * (8 - (move[1] - '0'));
+  dest = move[2] - 'a' + 8 * (8 - (move[3] - '0'));
+  switch (move[4])
     {
-      decimal_score = -decimal_score;
+    case 'r':
+      type = MOVE_TYPE_PROMOTION_TO_ROOK;
+      break;
+    case 'b':
+      type = MOVE_TYPE_PROMOTION_TO_BISHOP;
+      break;
+    case 'n':
+      type = MOVE_TYPE_PROMOTION_TO_KNIGHT;
+      break;
+    default:
+      type = MOVE_TYPE_PROMOTION_TO_QUEEN;
     }
 
-  /* After searching, print results */
-  printf
-    ("Search result: move = %c%d%c%d; depth = %d, score = %.2f, time = %.2fs knps = %.2f\n countCapCalls = %d\n countQSearch = %d\n moves made = %d\n ratio_Qsearc_Capcalls = %.2f\n",
-     'a' + COL (m.from), 8 - ROW (m.from), 'a' + COL (m.dest),
-     8 - ROW (m.dest), depth, decimal_score, t, knps, count_cap_calls,
-     count_quies_calls, count_MakeMove, ratio_Qsearc_Capcalls);
-  return m;
+  pos->ply = 0;
+  movecnt = GenLegalMoves (pos, moveBuf);
+  for (i = 0; i < movecnt; i++)
+    if (MOVE_FROM (moveBuf[i]) == from && MOVE_DEST (moveBuf[i]) == dest)
+      {
+	if (pos->piece[from] == PAWN && (dest < 8 || dest > 55))
+	  moveBuf[i] = NEW_MOVE (from, dest, type);
+	MakeMove (pos, moveBuf[i]);
+	return 1;
+      }
+  return 0;
+}
+
+int
+EngineSearch (ENGINE * engine, int depth, char *move)
+{
+  MOVE m;
+  int score;
+
+  if (depth > MAX_DEPTH)
+    depth = MAX_DEPTH;
+  m = ComputerThink (engine, depth, &score);
+  if (m == NO_MOVE)
+    move[0] = '\0';
+  else
+    MoveToString (m, move);
+  return score;
 }
 
 /*
@@ -1607,7 +3888,7 @@ ComputerThink (int depth)
  */
 
 void
-PrintBoard ()
+PrintBoard (POSITION * pos)
 {
   char pieceName[] = "PNBRQKpnbrqk";
   int i;
@@ -1622,21 +3903,22 @@ PrintBoard ()
 	    }
 	}
 
-      if (piece[i] == EMPTY && ((((unsigned) i) >> 3) % 2 == 0 && i % 2 == 0))
+      if (i == pos->eps_square)
+	printf (" * |");
+      else if (pos->piece[i] == EMPTY
+	       && ((((unsigned) i) >> 3) % 2 == 0 && i % 2 == 0))
 	printf ("   |");
-      else if (piece[i] == EMPTY
+      else if (pos->piece[i] == EMPTY
 	       && ((((unsigned) i) >> 3) % 2 != 0 && i % 2 != 0))
 	printf ("   |");
-      else if (piece[i] == EMPTY)
+      else if (pos->piece[i] == EMPTY)
 	printf ("   |");
-      else if (piece[i] == EPS_SQUARE)
-	printf (" * |");
       else
 	{
-	  if (color[i] == WHITE)
-	    printf (" %c |", pieceName[piece[i]]);
+	  if (pos->color[i] == WHITE)
+	    printf (" %c |", pieceName[pos->piece[i]]);
 	  else
-	    printf ("<%c>|", pieceName[piece[i] + 6]);
+	    printf ("<%c>|", pieceName[pos->piece[i] + 6]);
 	}
       if ((i & 7) == 7)
 	printf ("\n");
@@ -1649,7 +3931,7 @@ PrintBoard ()
 /* Returns the number of posible positions to a given depth. Based on the
  perft function on Danasah */
 unsigned long long
-perft (int depth)
+perft (POSITION * pos, int depth)
 {
   int i;
   int movecnt;			/* The number of available moves */
@@ -1658,100 +3940,591 @@ perft (int depth)
   if (!depth)
     return 1;
 
-  MOVE moveBuf[200];		/* List of movements */
+  MOVE moveBuf[MAX_MOVES];	/* List of movements */
 
-  /* Generate and count all moves for current position */
-  movecnt = GenMoves (side, moveBuf);
+  /* Generate and count all legal moves for current position. In the
+   * last ply that's all we need to know, there is no need to make them */
+  movecnt = GenLegalMoves (pos, moveBuf);
+  if (depth == 1)
+    return movecnt;
 
   /* Once we have all the moves available, we loop through them */
   for (i = 0; i < movecnt; ++i)
     {
-      /* Not a legal move? Then we unmake it and continue to the next one in the list */
-      if (!MakeMove (moveBuf[i]))
+      MakeMove (pos, moveBuf[i]);
+
+      /* This 'if' takes us to the deep of the position */
+      nodes += perft (pos, depth - 1);
+      TakeBack (pos);
+    }
+
+  return nodes;
+}
+
+/* perft with the cache: before counting the positions under a position
+ * we look whether they have already been counted. Without a cache it's
+ * just perft */
+unsigned long long
+PerftHashed (POSITION * pos, int depth, PERFTHASH * table)
+{
+  int i;
+  int movecnt;
+  unsigned long long nodes = 0;
+  unsigned long long data;
+  HASHKEY check;
+  PERFTENTRY *e;
+  MOVE moveBuf[MAX_MOVES];
+
+  /* The last ply is just a move generation, not worth caching */
+  if (depth < 2 || !table || !table->entries)
+    return perft (pos, depth);
+
+  e = &table->entries[(pos->hash_key ^ depth) & (table->size - 1)];
+  check = e->check;
+  data = e->data;
+  if ((check ^ data) == pos->hash_key && (int) (data & 0xFF) == depth)
+    return data >> 8;
+
+  movecnt = GenLegalMoves (pos, moveBuf);
+  for (i = 0; i < movecnt; ++i)
+    {
+      MakeMove (pos, moveBuf[i]);
+      nodes += PerftHashed (pos, depth - 1, table);
+      TakeBack (pos);
+    }
+
+  data = (nodes << 8) | depth;
+  e->check = pos->hash_key ^ data;
+  e->data = data;
+  return nodes;
+}
+
+/* perft of each move, to find where a wrong count comes from comparing
+ * with another program */
+unsigned long long
+Divide (POSITION * pos, int depth, PERFTHASH * table)
+{
+  int i;
+  int movecnt;
+  unsigned long long count;
+  unsigned long long nodes = 0;
+  char move_str[6];
+  MOVE moveBuf[MAX_MOVES];
+
+  if (depth < 1)
+    return 1;
+  movecnt = GenLegalMoves (pos, moveBuf);
+  for (i = 0; i < movecnt; ++i)
+    {
+      MakeMove (pos, moveBuf[i]);
+      count = PerftHashed (pos, depth - 1, table);
+      TakeBack (pos);
+      MoveToString (moveBuf[i], move_str);
+      printf ("%s %llu\n", move_str, count);
+      nodes += count;
+    }
+  printf ("%d moves, %llu nodes\n", movecnt, nodes);
+  return nodes;
+}
+
+/* Parallel perft. The tree is split at a few plies from the root: each
+ * position there is a task, counted by one thread on its own copy of the
+ * board. Every thread has a queue of tasks; it takes them from the bottom
+ * of its own one, and when it's empty it steals from the top of the queue
+ * of another thread, so all of them keep busy until the end */
+#define PERFT_MAX_SPLIT 8
+
+typedef struct tag_PERFTTASK
+{
+  MOVE path[PERFT_MAX_SPLIT];	/* The moves from the root to the task */
+  int root;			/* Which root move it comes from */
+} PERFTTASK;
+
+typedef struct tag_PERFTQUEUE
+{
+  int top;			/* The tasks left are top ... bottom - 1 */
+  int bottom;
+  pthread_mutex_t lock;
+} PERFTQUEUE;
+
+typedef struct tag_PERFTPOOL
+{
+  POSITION *root;
+  PERFTHASH *table;		/* Shared by all the threads */
+  int depth;			/* Depth of the perft */
+  int split;			/* Plies from the root to the tasks */
+  PERFTTASK *tasks;
+  int num_tasks;
+  int num_queues;
+  PERFTQUEUE queues[MAX_THREADS];
+  unsigned long long counts[MAX_MOVES];	/* Of each root move */
+} PERFTPOOL;
+
+typedef struct tag_PERFTWORKER
+{
+  PERFTPOOL *pool;
+  int id;
+  pthread_t handle;
+  POSITION pos;
+} PERFTWORKER;
+
+/* Add to the pool a task for every position split plies under pos.
+ * Returns 0 if there isn't memory enough for all of them */
+int
+PerftTasks (PERFTPOOL * pool, POSITION * pos, int ply, MOVE * path, int root)
+{
+  int i;
+  int movecnt;
+  int ok;
+  MOVE moveBuf[MAX_MOVES];
+  PERFTTASK *tasks;
+
+  if (ply == pool->split)
+    {
+      if ((pool->num_tasks & 1023) == 0)
 	{
-	  TakeBack ();
-	  continue;
+	  tasks = realloc (pool->tasks,
+			   (pool->num_tasks + 1024) * sizeof (PERFTTASK));
+	  if (!tasks)
+	    return 0;
+	  pool->tasks = tasks;
 	}
+      memcpy (pool->tasks[pool->num_tasks].path, path, ply * sizeof (MOVE));
+      pool->tasks[pool->num_tasks].root = root;
+      pool->num_tasks++;
+      return 1;
+    }
+
+  movecnt = GenLegalMoves (pos, moveBuf);
+  for (i = 0; i < movecnt; i++)
+    {
+      path[ply] = moveBuf[i];
+      MakeMove (pos, moveBuf[i]);
+      ok = PerftTasks (pool, pos, ply + 1, path, ply == 0 ? i : root);
+      TakeBack (pos);
+      if (!ok)
+	return 0;
+    }
+  return 1;
+}
 
-      /* Just in case we want to count for checks */
-//        if (IsInCheck(side))
-//        {
-//            count_checks++;
-//        }
+/* Take a task from queue q: the owner from the bottom, the thieves from the
+ * top. Returns 0 if it's empty */
+int
+PerftTakeTask (PERFTQUEUE * q, int steal, int *task)
+{
+  int found = 0;
 
-      /* This 'if' takes us to the deep of the position */
-      nodes += perft (depth - 1);
-      TakeBack ();
+  pthread_mutex_lock (&q->lock);
+  if (q->top < q->bottom)
+    {
+      *task = steal ? q->top++ : --q->bottom;
+      found = 1;
     }
+  pthread_mutex_unlock (&q->lock);
+  return found;
+}
 
-  return nodes;
+void *
+PerftWorker (void *arg)
+{
+  PERFTWORKER *worker = (PERFTWORKER *) arg;
+  PERFTPOOL *pool = worker->pool;
+  PERFTTASK *t;
+  int task = 0;
+  int i;
+  unsigned long long nodes;
+
+  for (;;)
+    {
+      if (!PerftTakeTask (&pool->queues[worker->id], 0, &task))
+	{
+	  /* Nothing left of ours, we look for work in the others */
+	  for (i = 1; i < pool->num_queues; i++)
+	    if (PerftTakeTask (&pool->queues[(worker->id + i) %
+					     pool->num_queues], 1, &task))
+	      break;
+	  if (i == pool->num_queues)
+	    return NULL;
+	}
+
+      t = &pool->tasks[task];
+      CopyPosition (&worker->pos, pool->root);
+      for (i = 0; i < pool->split; i++)
+	MakeMove (&worker->pos, t->path[i]);
+      nodes = PerftHashed (&worker->pos, pool->depth - pool->split,
+			   pool->table);
+      __sync_fetch_and_add (&pool->counts[t->root], nodes);
+    }
+}
+
+/* perft of pos with several threads, printing the count of each move as
+ * Divide does. The tasks are the positions split plies deep. The count
+ * goes to pCount; returns 0 if there isn't memory enough, and then there
+ * is no count, as a wrong one would be worse */
+int
+PerftParallel (POSITION * pos, int depth, int threads, int split,
+	       PERFTHASH * table, unsigned long long *pCount)
+{
+  PERFTPOOL *pool;
+  PERFTWORKER *workers;
+  MOVE moveBuf[MAX_MOVES];
+  MOVE path[PERFT_MAX_SPLIT];
+  int movecnt;
+  int i;
+  unsigned long long nodes = 0;
+  char move_str[6];
+
+  /* The tasks can't be deeper than the perft itself */
+  if (threads < 1)
+    threads = 1;
+  if (threads > MAX_THREADS)
+    threads = MAX_THREADS;
+  if (split > PERFT_MAX_SPLIT)
+    split = PERFT_MAX_SPLIT;
+  if (split > depth - 1)
+    split = depth - 1;
+  if (split < 1)
+    {
+      *pCount = Divide (pos, depth, table);
+      return 1;
+    }
+
+  pool = calloc (1, sizeof (PERFTPOOL));
+  workers = malloc (threads * sizeof (PERFTWORKER));
+  if (!pool || !workers)
+    {
+      puts ("Not enough memory for the threads");
+      free (pool);
+      free (workers);
+      return 0;
+    }
+  pool->root = pos;
+  pool->table = table;
+  pool->depth = depth;
+  pool->split = split;
+  if (!PerftTasks (pool, pos, 0, path, 0))
+    {
+      puts ("Not enough memory for the perft tasks");
+      free (pool->tasks);
+      free (pool);
+      free (workers);
+      return 0;
+    }
+
+  /* The tasks are dealt out evenly, and then stolen as needed */
+  pool->num_queues = threads;
+  for (i = 0; i < threads; i++)
+    {
+      pool->queues[i].top = (int) ((long long) pool->num_tasks * i / threads);
+      pool->queues[i].bottom =
+	(int) ((long long) pool->num_tasks * (i + 1) / threads);
+      pthread_mutex_init (&pool->queues[i].lock, NULL);
+    }
+
+  for (i = 0; i < threads; i++)
+    {
+      workers[i].pool = pool;
+      workers[i].id = i;
+      if (i > 0 && pthread_create (&workers[i].handle, NULL, PerftWorker,
+				   &workers[i]))
+	{
+	  /* Its tasks will be stolen by the others */
+	  printf ("Could not start thread %d\n", i);
+	  workers[i].id = -1;
+	}
+    }
+  PerftWorker (&workers[0]);
+  for (i = 1; i < threads; i++)
+    if (workers[i].id != -1)
+      pthread_join (workers[i].handle, NULL);
+
+  movecnt = GenLegalMoves (pos, moveBuf);
+  for (i = 0; i < movecnt; i++)
+    {
+      MoveToString (moveBuf[i], move_str);
+      printf ("%s %llu\n", move_str, pool->counts[i]);
+      nodes += pool->counts[i];
+    }
+  printf ("%d moves, %llu nodes\n", movecnt, nodes);
+
+  for (i = 0; i < threads; i++)
+    pthread_mutex_destroy (&pool->queues[i].lock);
+  free (pool->tasks);
+  free (pool);
+  free (workers);
+  *pCount = nodes;
+  return 1;
+}
+
+/* Run the perft of every position in an EPD file and compare it with the
+ * right counts. Each line is a FEN and then the depths and their counts,
+ * v.g. "<fen> ;D1 20 ;D2 400 ;D3 8902". Only the deepest one is run, the
+ * others are counted there anyway. table is the perft cache, if any.
+ * Returns the number of failures */
+int
+PerftSuite (POSITION * pos, const char *file, PERFTHASH * table)
+{
+  FILE *f;
+  char line[1024];
+  char *p;
+  int i;
+  int depth;
+  int deepest;
+  int n = 0;
+  int failed = 0;
+  unsigned long long count;
+  unsigned long long expected;
+  unsigned long long total = 0;
+  clock_t start;
+  double t;
+  double total_time = 0.0;
+
+  f = fopen (file, "r");
+  if (!f)
+    {
+      printf ("Can't open %s\n", file);
+      return -1;
+    }
+
+  while (fgets (line, sizeof (line), f))
+    {
+      p = strchr (line, ';');
+      if (!p)
+	continue;
+      *p++ = '\0';
+      for (i = strlen (line); i > 0 && line[i - 1] == ' '; i--)
+	line[i - 1] = '\0';
+
+      /* The deepest of the depths */
+      deepest = 0;
+      expected = 0;
+      while (p)
+	{
+	  if (sscanf (p, " D%d %llu", &depth, &count) == 2
+	      && depth > deepest)
+	    {
+	      deepest = depth;
+	      expected = count;
+	    }
+	  p = strchr (p, ';');
+	  if (p)
+	    p++;
+	}
+      if (!deepest)
+	continue;
+      n++;
+      if (!SetFen (pos, line))
+	{
+	  printf ("%2d BAD FEN %s\n", n, line);
+	  failed++;
+	  continue;
+	}
+
+      start = clock ();
+      count = PerftHashed (pos, deepest, table);
+      t = (double) (clock () - start) / CLOCKS_PER_SEC;
+      if (t <= 0)
+	t = 0.001;
+      total += count;
+      total_time += t;
+      if (count != expected)
+	failed++;
+      printf ("%2d %s D%d %llu", n, count == expected ? "ok  " : "FAIL",
+	      deepest, count);
+      if (count != expected)
+	printf (" (%llu expected)", expected);
+      printf (" %.2f s %.2f Mnps  %s\n", t, (count / t) / 1000000, line);
+    }
+  fclose (f);
+
+  printf ("%d positions, %d failed, %llu nodes in %.2f s, %.2f Mnps%s\n",
+	  n, failed, total, total_time,
+	  total_time > 0 ? (total / total_time) / 1000000 : 0.0,
+	  table && table->entries ? " (with the perft cache)" : "");
+  return failed;
 }
 
 
+/* The positions of bench: openings, middlegames and endgames, quiet and
+ * tactical ones. Don't change them, or the signature changes too */
+#define BENCH_DEPTH 9
+
+const char *bench_fens[] = {
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+  "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10",
+  "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 11",
+  "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+  "rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
+  "r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
+  "r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - - 2 15",
+  "r1bbk1nr/pp3p1p/2n5/1N4p1/2Np1B2/8/PPP2PPP/2KR1B1R w kq - 0 13",
+  "r1bq1rk1/ppp1nppp/4n3/3p3Q/3P4/1BP1B3/PP1N2PP/R4RK1 w - - 1 16",
+  "4r1k1/r1q2ppp/ppp2n2/4P3/5Rb1/1N1BQ3/PPP3PP/R5K1 w - - 1 17",
+  "2rqkb1r/ppp2p2/2npb1p1/1N1Nn2p/2P1PP2/8/PP2B1PP/R1BQK2R b KQ - 0 11",
+  "r1bq1r1k/b1p1npp1/p2p3p/1p6/3PP3/1B2NN2/PP3PPP/R2Q1RK1 w - - 1 16",
+  "3r1rk1/p5pp/bpp1pp2/8/q1PP1P2/b3P3/P2NQRPP/1R2B1K1 b - - 6 22",
+  "r1q2rk1/2p1bppp/2Pp4/p6b/Q1PNp3/4B3/PP1R1PPP/2K4R w - - 2 18",
+  "4k2r/1pb2ppp/1p2p3/1R1p4/3P4/2r1PN2/P4PPP/1R4K1 b - - 3 22",
+  "3q2k1/pb3p1p/4pbp1/2r5/PpN2N2/1P2P2P/5PP1/Q2R2K1 b - - 4 26",
+  "6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/3N4 b - - 0 1",
+  "3b4/5kp1/1p1p1p1p/pP1PpP1P/P1P1P3/3KN3/8/8 w - - 0 1",
+  "2K5/p7/7P/5pR1/8/5k2/r7/8 w - - 0 1",
+  "8/6pk/1p6/8/PP3p1p/5P2/4KP1q/3Q4 w - - 0 1",
+  "7k/3p2pp/4q3/8/4Q3/5Kp1/P6b/8 w - - 0 1",
+  "8/2p5/8/2kPKp1p/2p4P/2P5/3P4/8 w - - 0 1",
+  "8/1p3pp1/7p/5P1P/2k3P1/8/2K2P2/8 w - - 0 1",
+  "8/pp2r1k1/2p1p3/3pP2p/1P1P1P1P/P5KR/8/8 w - - 0 1",
+  "8/3p4/p1bk3p/Pp6/1Kp1PpPp/2P2P1P/2P5/5B2 b - - 0 1",
+  "5k2/7R/4P2p/5K2/p1r2P1p/8/8/8 b - - 0 1",
+  "6k1/6p1/P6p/r1N5/5p2/7P/1b3PP1/4R1K1 w - - 0 1",
+  "1r3k2/4q3/2Pp3b/3Bp3/2Q2p2/1p1P2P1/1P2KP2/3N4 w - - 0 1",
+  "6k1/4pp1p/3p2p1/P1pPb3/R7/1r2P1PP/3B1P2/6K1 w - - 0 1",
+  "8/3p3B/5p2/5P2/p7/PP5b/k7/6K1 w - - 0 1",
+  "8/8/8/8/5kp1/P7/8/1K1N4 w - - 0 1",
+  "8/8/8/5N2/8/p7/8/2NK3k w - - 0 1",
+  "8/3k4/8/8/8/4B3/4KB2/2B5 w - - 0 1",
+  "8/8/1P6/5pr1/8/4R3/7k/2K5 w - - 0 1",
+  "8/2p4P/8/kr6/6R1/8/8/1K6 w - - 0 1",
+  "8/8/3P3k/8/1p6/8/1P6/1K3n2 b - - 0 1",
+  "8/R7/2q5/8/6k1/8/1P5p/K6R w - - 0 124",
+  "6k1/3b3r/1p1p4/p1n2p2/1PPNpP1q/P3Q1p1/1R1RB1P1/5K2 b - - 0 1",
+  "r2r1n2/pp2bk2/2p1p2p/3q4/3PN1QP/2P3R1/P4PP1/5RK1 w - - 0 1",
+  "8/8/8/8/8/6k1/6p1/6K1 w - - 0 1",
+  NULL
+};
+
+/* Search every bench position to depth with a new engine, so the game in
+ * progress isn't touched, and print how many nodes it took. With one
+ * thread the search is always the same, so the total number of nodes is a
+ * signature of it: it changes only when the search does */
+void
+Bench (int depth, int threads, int hash_mb)
+{
+  ENGINE *engine;
+  int i;
+  int j;
+  unsigned long long nodes;
+  unsigned long long total = 0;
+  long long start;
+  long long elapsed;
+  MOVE m;
+  char move_str[6];
+#ifdef PROFILE
+  PROFDATA prof;
+  memset (&prof, 0, sizeof (prof));
+#endif
+
+  engine = EngineCreate (hash_mb);
+  if (!engine)
+    {
+      puts ("Not enough memory");
+      return;
+    }
+  SetThreads (engine, threads);
+
+  start = GetTime ();
+  for (i = 0; bench_fens[i]; i++)
+    {
+      if (!SetFen (&engine->pos, bench_fens[i]))
+	{
+	  printf ("Wrong FEN %s\n", bench_fens[i]);
+	  continue;
+	}
+      HashClear (&engine->hash);
+      m = ComputerThink (engine, depth, NULL);
+      nodes = 0;
+      for (j = 0; j < engine->num_threads; j++)
+	nodes += engine->threads[j].nodes;
+      total += nodes;
+#ifdef PROFILE
+      AddProfile (&prof, engine);
+#endif
+      if (m == NO_MOVE)
+	strcpy (move_str, "none");
+      else
+	MoveToString (m, move_str);
+      printf ("%2d %-5s %10llu  %s\n", i + 1, move_str, nodes,
+	      bench_fens[i]);
+    }
+  elapsed = GetTime () - start;
+  if (elapsed <= 0)
+    elapsed = 1;
+
+  printf ("Depth %d, %d threads, %d MB\n", depth, engine->num_threads,
+	  hash_mb);
+  printf ("Time: %lld ms\n", elapsed);
+  printf ("Nodes/second: %llu\n", total * 1000 / elapsed);
+  printf ("Nodes searched: %llu\n", total);
+  if (engine->num_threads > 1)
+    printf ("With threads the nodes change from run to run\n");
+#ifdef PROFILE
+  PrintProfile (&prof);
+#endif
+  EngineDestroy (engine);
+}
+
 /*
  ****************************************************************************
  * Main program *
  ****************************************************************************
  */
+/* Compile with -DSECONDCHESS_LIB to use the engine from another program,
+ * see secondchess.h */
+#ifndef SECONDCHESS_LIB
+
 
 void
-startgame ()
+startgame (POSITION * pos)
 {
-  int i;
-  for (i = 0; i < 64; ++i)
-    {
-      piece[i] = init_piece[i];
-      color[i] = init_color[i];
-    }
-
-  side = WHITE;
+  StartPosition (pos);
   computer_side = BLACK;	/* Human is white side */
-  hdp = 0;
-  castle_rights = 15;
 }
 
 void
-xboard ()
+xboard (ENGINE * engine)
 {
-  char line[256], command[256], c;
-  int from, dest, i;
-  MOVE moveBuf[200], bestMove;
+  POSITION *pos = &engine->pos;
+  char line[256], command[256], move_str[6];
+  int from, dest, i, n;
+  MOVE moveBuf[MAX_MOVES], bestMove;
   int movecnt;
+  int minutes, seconds;
   //int illegal_king = 0;
 
   printf ("\n");
 
-  startgame ();
+  startgame (pos);
+
+  /* Under xboard we play by time, until xboard tells us otherwise we
+   * assume 5 minutes for the whole game */
+  max_depth = MAX_DEPTH;
+  engine->time_left = 5 * 60 * 1000;
+  engine->post = 1;
 
   for (;;)
     {
       fflush (stdout);
-      if (side == computer_side)
+      if (pos->side == computer_side)
 	{			/* computer's turn */
 	  /* Find out the best move to react the current position */
-	  bestMove = ComputerThink (max_depth);
-	  MakeMove (bestMove);
-	  /* send move */
-	  switch (bestMove.type)
+	  bestMove = ComputerThink (engine, max_depth, NULL);
+	  /* No move at all: the game is over, mate or stalemate */
+	  if (bestMove == NO_MOVE)
 	    {
-	    case MOVE_TYPE_PROMOTION_TO_QUEEN:
-	      c = 'q';
-	      break;
-	    case MOVE_TYPE_PROMOTION_TO_ROOK:
-	      c = 'r';
-	      break;
-	    case MOVE_TYPE_PROMOTION_TO_BISHOP:
-	      c = 'b';
-	      break;
-	    case MOVE_TYPE_PROMOTION_TO_KNIGHT:
-	      c = 'n';
-	      break;
-	    default:
-	      c = ' ';
+	      if (!IsInCheck (pos, pos->side))
+		printf ("1/2-1/2 {Stalemate}\n");
+	      else if (pos->side == WHITE)
+		printf ("0-1 {Black mates}\n");
+	      else
+		printf ("1-0 {White mates}\n");
+	      computer_side = EMPTY;
+	      continue;
 	    }
-	  printf ("move %c%d%c%d%c\n", 'a' + COL (bestMove.from), 8
-		      - ROW (bestMove.from), 'a' + COL (bestMove.dest), 8
-		      - ROW (bestMove.dest), c);
+	  MakeMove (pos, bestMove);
+	  /* send move */
+	  MoveToString (bestMove, move_str);
+	  printf ("move %s\n", move_str);
 	  continue;
 	}
 
@@ -1764,9 +4537,47 @@ xboard ()
 	{
 	  continue;
 	}
+      if (!strcmp (command, "protover"))
+	{
+	  printf ("feature memory=1 smp=1 setboard=1\n");
+	  printf ("feature option=\"NullMove -check 1\"\n");
+	  printf ("feature option=\"LMR -check 1\"\n");
+	  printf ("feature option=\"Futility -check 1\"\n");
+	  printf ("feature option=\"ReverseFutility -check 1\"\n");
+	  printf ("feature done=1\n");
+	  continue;
+	}
+      if (!strcmp (command, "option"))
+	{
+	  /* option NAME=VALUE */
+	  char name[64];
+	  if (sscanf (line, "option %63[^=]=%d", name, &n) == 2)
+	    EngineSetOption (engine, name, n);
+	  continue;
+	}
+      if (!strcmp (command, "setboard"))
+	{
+	  if (!SetFen (pos, line + 9))
+	    printf ("tellusererror Illegal position\n");
+	  continue;
+	}
       if (!strcmp (command, "new"))
 	{
-	  startgame ();
+	  startgame (pos);
+	  HashClear (&engine->hash);
+	  continue;
+	}
+      if (!strcmp (command, "memory"))
+	{
+	  sscanf (line, "memory %d", &n);
+	  if (!HashAlloc (&engine->hash, n))
+	    printf ("Error (not enough memory): memory %d\n", n);
+	  continue;
+	}
+      if (!strcmp (command, "cores"))
+	{
+	  sscanf (line, "cores %d", &n);
+	  SetThreads (engine, n);
 	  continue;
 	}
       if (!strcmp (command, "quit"))
@@ -1780,14 +4591,16 @@ xboard ()
 	}
       if (!strcmp (command, "white"))
 	{
-	  side = WHITE;
+	  pos->side = WHITE;
 	  computer_side = BLACK;
+	  pos->hash_key = HashKey (pos);
 	  continue;
 	}
       if (!strcmp (command, "black"))
 	{
-	  side = BLACK;
+	  pos->side = BLACK;
 	  computer_side = WHITE;
+	  pos->hash_key = HashKey (pos);
 	  continue;
 	}
       if (!strcmp (command, "sd"))
@@ -1795,24 +4608,55 @@ xboard ()
 	  sscanf (line, "sd %d", &max_depth);
 	  continue;
 	}
+      if (!strcmp (command, "st"))
+	{
+	  sscanf (line, "st %d", &engine->time_per_move);
+	  engine->time_per_move *= 1000;
+	  continue;
+	}
+      if (!strcmp (command, "level"))
+	{
+	  /* level MPS BASE INC, where BASE is minutes or minutes:seconds */
+	  seconds = 0;
+	  if (sscanf (line, "level %d %d:%d %d", &engine->moves_per_session,
+		      &minutes, &seconds, &engine->time_inc) != 4)
+	    sscanf (line, "level %d %d %d", &engine->moves_per_session,
+		    &minutes, &engine->time_inc);
+	  engine->time_left = (minutes * 60 + seconds) * 1000;
+	  engine->time_inc *= 1000;
+	  engine->time_per_move = -1;
+	  continue;
+	}
+      if (!strcmp (command, "time"))
+	{
+	  /* Our clock, in centiseconds */
+	  sscanf (line, "time %d", &engine->time_left);
+	  engine->time_left *= 10;
+	  continue;
+	}
+      if (!strcmp (command, "otim"))
+	{
+	  /* The opponent's clock: we don't use it */
+	  continue;
+	}
       if (!strcmp (command, "go"))
 	{
-	  computer_side = side;
+	  computer_side = pos->side;
 	  continue;
 	}
       if (!strcmp (command, "undo"))
 	{
-	  if (hdp == 0)
+	  if (pos->hdp == 0)
 	    continue;
-	  TakeBack ();
+	  TakeBack (pos);
 	  continue;
 	}
       if (!strcmp (command, "remove"))
 	{
-	  if (hdp <= 1)
+	  if (pos->hdp <= 1)
 	    continue;
-	  TakeBack ();
-	  TakeBack ();
+	  TakeBack (pos);
+	  TakeBack (pos);
 	  continue;
 	}
 
@@ -1832,14 +4676,14 @@ xboard ()
       from += 8 * (8 - (command[1] - '0'));
       dest = command[2] - 'a';
       dest += 8 * (8 - (command[3] - '0'));
-      ply = 0;
-      movecnt = GenMoves (side, moveBuf);
+      pos->ply = 0;
+      movecnt = GenMoves (pos, pos->side, moveBuf);
 
       /* loop through the moves to see if it's legal */
       for (i = 0; i < movecnt; ++i) {
-		if (moveBuf[i].from == from && moveBuf[i].dest == dest)
+		if (MOVE_FROM (moveBuf[i]) == from && MOVE_DEST (moveBuf[i]) == dest)
 	  	{
-			if (piece[from] == PAWN && (dest < 8 || dest > 55)) 
+			if (pos->piece[from] == PAWN && (dest < 8 || dest > 55)) 
 			{
 				if (command[4] != 'q' && command[4] != 'r' && command[4] != 'b' && command[4] != 'n')
 				{
@@ -1849,21 +4693,21 @@ xboard ()
 				switch (command[4])
 				{
 					case 'q':
-						moveBuf[i].type = MOVE_TYPE_PROMOTION_TO_QUEEN;
+						moveBuf[i] = NEW_MOVE (from, dest, MOVE_TYPE_PROMOTION_TO_QUEEN);
 						break;
 					case 'r':
-						moveBuf[i].type = MOVE_TYPE_PROMOTION_TO_ROOK;
+						moveBuf[i] = NEW_MOVE (from, dest, MOVE_TYPE_PROMOTION_TO_ROOK);
 						break;
 					case 'b':
-						moveBuf[i].type = MOVE_TYPE_PROMOTION_TO_BISHOP;
+						moveBuf[i] = NEW_MOVE (from, dest, MOVE_TYPE_PROMOTION_TO_BISHOP);
 						break;
 					case 'n':
-						moveBuf[i].type = MOVE_TYPE_PROMOTION_TO_KNIGHT;
+						moveBuf[i] = NEW_MOVE (from, dest, MOVE_TYPE_PROMOTION_TO_KNIGHT);
 						break;						
 				}
 			}
 		
-	    	if (MakeMove (moveBuf[i]))
+	    	if (MakeMove (pos, moveBuf[i]))
 	    	{
 				goto goon;	/* legal move */
 			}
@@ -1881,7 +4725,7 @@ goon:
 }
 
 int
-main ()
+main (int argc, char *argv[])
 {
 
   setlocale (LC_ALL, "");
@@ -1891,13 +4735,44 @@ main ()
   char s[256];
   int from;
   int dest;
-  int i;
+  int i, n;
+  int hash_mb = 64;
+  int threads = 1;
+  int perft_hash_mb = PERFT_HASH_MB;
+  ENGINE *engine;
+  POSITION *pos;
   //int computer_side;
 
-  startgame ();
+  /* secondchess bench [depth] [threads] [hash] just runs the benchmark */
+  if (argc > 1 && !strcmp (argv[1], "bench"))
+    {
+      Bench (argc > 2 ? atoi (argv[2]) : BENCH_DEPTH,
+	     argc > 3 ? atoi (argv[3]) : 1, argc > 4 ? atoi (argv[4]) : 16);
+      return 0;
+    }
+
+  /* Command line options */
+  for (i = 1; i < argc; i++)
+    {
+      if (!strcmp (argv[i], "-hash") && i + 1 < argc)
+	hash_mb = atoi (argv[++i]);
+      else if (!strcmp (argv[i], "-threads") && i + 1 < argc)
+	threads = atoi (argv[++i]);
+    }
+
+  engine = EngineCreate (hash_mb);
+  if (!engine)
+    {
+      puts ("Not enough memory");
+      return 1;
+    }
+  SetThreads (engine, threads);
+  engine->post = 1;
+  pos = &engine->pos;
+  startgame (pos);
 
   max_depth = 4;		/* max depth to search */
-  MOVE moveBuf[200];
+  MOVE moveBuf[MAX_MOVES];
   int movecnt;
 
   puts ("Second Chess, by Emilio Diaz");
@@ -1907,21 +4782,43 @@ main ()
   puts (" on: force computer to move");
   puts (" quit: exit");
   puts (" sd n: set engine depth to n plies (default 4)");
+  puts (" hash n: set the hash table size to n MB (default 64, or -hash n)");
+  puts (" threads n: search with n threads (default 1, or -threads n)");
+  puts (" option NAME n: switch NullMove, LMR, Futility or ReverseFutility");
+  puts ("   on (1) or off (0)");
+  puts (" fen FEN: set up the position of a FEN string");
+  puts (" perft n [threads t] [split s] [hash]: count the positions n plies");
+  puts ("   deep, with t threads splitting the tree s plies deep (default 2).");
+  puts ("   With hash it uses the perft cache, faster but then the Mnps");
+  puts ("   aren't the move generator's");
+  puts (" divide n: perft of each move, with the perft cache");
+  puts (" perfthash n: perft cache of n MB (default 64, 0 for none)");
+  puts (" perftsuite file [hash]: check the perft counts of an EPD file,");
+  puts ("   v.g. perftsuite perftsuite.epd. With hash it uses the perft cache,");
+  puts ("   faster but then the Mnps aren't the move generator's");
+  puts (" bench [depth] [threads] [hash]: search the bench positions,");
+  puts ("   also as secondchess bench [depth] [threads] [hash]");
   puts (" undo: take back last move");
 
-  side = WHITE;
+  pos->side = WHITE;
   computer_side = BLACK;	/* Human is white side */
 
-  hdp = 0;			/* Current move order */
+  pos->hdp = 0;			/* Current move order */
   for (;;)
     {
-      if (side == computer_side)
+      if (pos->side == computer_side)
 	{			/* Computer's turn */
 	  /* Find out the best move to react the current position */
-	  MOVE bestMove = ComputerThink (max_depth);
-	  MakeMove (bestMove);
-	  PrintBoard ();
-	  printf ("CASTLE: %d\n", castle_rights);
+	  MOVE bestMove = ComputerThink (engine, max_depth, NULL);
+	  if (bestMove == NO_MOVE)
+	    {
+	      puts (IsInCheck (pos, pos->side) ? "Checkmate" : "Stalemate");
+	      computer_side = EMPTY;
+	      continue;
+	    }
+	  MakeMove (pos, bestMove);
+	  PrintBoard (pos);
+	  printf ("CASTLE: %d\n", pos->castle_rights);
 	  continue;
 	}
 
@@ -1931,29 +4828,30 @@ main ()
 	return 0;
       if (!strcmp (s, "d"))
 	{
-	  PrintBoard ();
+	  PrintBoard (pos);
 	  continue;
 	}
       if (!strcmp (s, "undo"))
 	{
-	  TakeBack ();
-	  PrintBoard ();
+	  TakeBack (pos);
+	  PrintBoard (pos);
 	  computer_side = (WHITE + BLACK) - computer_side;
 	  continue;
 	}
       if (!strcmp (s, "xboard"))
 	{
-	  xboard ();
+	  xboard (engine);
 	  return 0;
 	}
       if (!strcmp (s, "on"))
 	{
-	  computer_side = side;
+	  computer_side = pos->side;
 	  continue;
 	}
       if (!strcmp (s, "pass"))
 	{
-	  side = (WHITE + BLACK) - side;
+	  pos->side = (WHITE + BLACK) - pos->side;
+	  pos->hash_key = HashKey (pos);
 	  continue;
 	}
       if (!strcmp (s, "sd"))
@@ -1961,22 +4859,118 @@ main ()
 	  scanf ("%d", &max_depth);
 	  continue;
 	}
+      if (!strcmp (s, "hash"))
+	{
+	  scanf ("%d", &n);
+	  if (!HashAlloc (&engine->hash, n))
+	    printf ("Not enough memory, the hash table is still %d MB\n",
+		    engine->hash.mb);
+	  continue;
+	}
+      if (!strcmp (s, "threads"))
+	{
+	  scanf ("%d", &n);
+	  SetThreads (engine, n);
+	  continue;
+	}
+      if (!strcmp (s, "option"))
+	{
+	  scanf ("%63s %d", s, &n);
+	  if (!EngineSetOption (engine, s, n))
+	    printf ("Unknown option %s\n", s);
+	  continue;
+	}
+      if (!strcmp (s, "fen"))
+	{
+	  /* The rest of the line */
+	  if (fgets (s, sizeof (s), stdin) && !SetFen (pos, s))
+	    puts ("Wrong FEN");
+	  computer_side = EMPTY;
+	  PrintBoard (pos);
+	  continue;
+	}
+      if (!strcmp (s, "divide"))
+	{
+	  scanf ("%d", &n);
+	  if (!engine->perft_hash.entries && perft_hash_mb)
+	    PerftHashAlloc (&engine->perft_hash, perft_hash_mb);
+	  Divide (pos, n, &engine->perft_hash);
+	  continue;
+	}
+      if (!strcmp (s, "perfthash"))
+	{
+	  scanf ("%d", &perft_hash_mb);
+	  PerftHashAlloc (&engine->perft_hash, perft_hash_mb);
+	  continue;
+	}
+      if (!strcmp (s, "bench"))
+	{
+	  /* bench [depth] [threads] [hash], the rest of the line */
+	  int depth = BENCH_DEPTH;
+	  int bench_threads = 1;
+	  int bench_hash = 16;
+	  if (fgets (s, sizeof (s), stdin))
+	    sscanf (s, "%d %d %d", &depth, &bench_threads, &bench_hash);
+	  Bench (depth, bench_threads, bench_hash);
+	  continue;
+	}
+      if (!strcmp (s, "perftsuite"))
+	{
+	  /* perftsuite file [hash], by default without the perft cache
+	   * so the speed is the one of the move generator */
+	  char file[256];
+	  int cached = 0;
+	  scanf ("%255s", file);
+	  if (fgets (s, sizeof (s), stdin) && strstr (s, "hash"))
+	    cached = 1;
+	  if (cached && !engine->perft_hash.entries && perft_hash_mb)
+	    PerftHashAlloc (&engine->perft_hash, perft_hash_mb);
+	  PerftSuite (pos, file, cached ? &engine->perft_hash : NULL);
+	  continue;
+	}
       if (!strcmp (s, "perft"))
 	{
+	  /* perft n [threads t] [split s] [hash], by default without the
+	   * perft cache so the speed is the one of the move generator */
+	  int perft_threads = 1;
+	  int split = 2;
+	  int cached = 0;
+	  PERFTHASH *table;
+	  char *p;
+	  unsigned long long count;
+	  long long start;
+	  double t;
+
 	  scanf ("%d", &max_depth);
-	  clock_t start;
-	  clock_t stop;
-	  double t = 0.0;
-	  /* Start timer */
-	  start = clock ();
-	  unsigned long long count = perft (max_depth);
-	  /* Stop timer */
-	  stop = clock ();
-	  t = (double) (stop - start) / CLOCKS_PER_SEC;
+	  if (fgets (s, sizeof (s), stdin))
+	    {
+	      if ((p = strstr (s, "threads")) != NULL)
+		sscanf (p, "threads %d", &perft_threads);
+	      if ((p = strstr (s, "split")) != NULL)
+		sscanf (p, "split %d", &split);
+	      if (strstr (s, "hash"))
+		cached = 1;
+	    }
+	  if (cached && !engine->perft_hash.entries && perft_hash_mb)
+	    PerftHashAlloc (&engine->perft_hash, perft_hash_mb);
+	  table = cached ? &engine->perft_hash : NULL;
+
+	  /* Wall time, with threads the cpu time is useless */
+	  start = GetTime ();
+	  if (perft_threads > 1)
+	    {
+	      if (!PerftParallel (pos, max_depth, perft_threads, split, table,
+				  &count))
+		continue;
+	    }
+	  else
+	    count = PerftHashed (pos, max_depth, table);
+	  t = (double) (GetTime () - start) / 1000.;
+	  if (t <= 0)
+	    t = 0.001;
 	  printf ("nodes = %llu\n", count);
 	  printf ("time = %.2f s\n", t);
-          double Mnps = (count/t)/1000000;
-          printf ("MegaNodes/second = %.2f Mnps\n", Mnps);
+	  printf ("MegaNodes/second = %.2f Mnps\n", (count / t) / 1000000);
 	  continue;
 	}
       if (!strcmp (s, "quit"))
@@ -1990,47 +4984,54 @@ main ()
       from += 8 * (8 - (s[1] - '0'));
       dest = s[2] - 'a';
       dest += 8 * (8 - (s[3] - '0'));
-      ply = 0;
-      movecnt = GenMoves (side, moveBuf);
+      pos->ply = 0;
+      movecnt = GenMoves (pos, pos->side, moveBuf);
 
       /* Loop through the moves to see if it's legal */
       for (i = 0; i < movecnt; i++)
-	if (moveBuf[i].from == from && moveBuf[i].dest == dest)
+	if (MOVE_FROM (moveBuf[i]) == from && MOVE_DEST (moveBuf[i]) == dest)
 	  {
 	    /* Promotion move? */
-	    if (piece[from] == PAWN && (dest < 8 || dest > 55))
+	    if (pos->piece[from] == PAWN && (dest < 8 || dest > 55))
 	      {
 		switch (s[4])
 		  {
 		  case 'q':
-		    moveBuf[i].type = MOVE_TYPE_PROMOTION_TO_QUEEN;
+		    moveBuf[i] =
+		      NEW_MOVE (from, dest, MOVE_TYPE_PROMOTION_TO_QUEEN);
 		    break;
 
 		  case 'r':
-		    moveBuf[i].type = MOVE_TYPE_PROMOTION_TO_ROOK;
+		    moveBuf[i] =
+		      NEW_MOVE (from, dest, MOVE_TYPE_PROMOTION_TO_ROOK);
 		    break;
 
 		  case 'b':
-		    moveBuf[i].type = MOVE_TYPE_PROMOTION_TO_BISHOP;
+		    moveBuf[i] =
+		      NEW_MOVE (from, dest, MOVE_TYPE_PROMOTION_TO_BISHOP);
 		    break;
 
 		  case 'n':
-		    moveBuf[i].type = MOVE_TYPE_PROMOTION_TO_KNIGHT;
+		    moveBuf[i] =
+		      NEW_MOVE (from, dest, MOVE_TYPE_PROMOTION_TO_KNIGHT);
 		    break;
 
 		  default:
 		    puts
 		      ("promoting to a McGuffin..., I'll give you a queen");
-		    moveBuf[i].type = MOVE_TYPE_PROMOTION_TO_QUEEN;
+		    moveBuf[i] =
+		      NEW_MOVE (from, dest, MOVE_TYPE_PROMOTION_TO_QUEEN);
 		  }
 	      }
-	    if (!MakeMove (moveBuf[i]))
+	    if (!MakeMove (pos, moveBuf[i]))
 	      {
-		TakeBack ();
+		TakeBack (pos);
 		printf ("Illegal move.\n");
 	      }
 	    break;
 	  }
-      PrintBoard ();
+      PrintBoard (pos);
     }
 }
+
+#endif
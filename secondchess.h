@@ -0,0 +1,59 @@
+/*
+secondchess - gpl, by Emilio Diaz, based on firstchess by Pham Hong Nguyen
+
+The engine as a library: compile secondchess.c with -DSECONDCHESS_LIB to
+leave main out, and use it from your program with these functions. Every
+engine has its own game, hash table and threads, so you can have as many
+of them as you want at the same time, v.g. to play them against each other.
+
+ ENGINE *e = EngineCreate (64);
+ EngineMakeMove (e, "e2e4");
+ EngineSearch (e, 6, move);
+ EngineDestroy (e);
+*/
+#ifndef SECONDCHESS_H
+#define SECONDCHESS_H
+
+typedef struct tag_ENGINE ENGINE;
+
+/* A new engine with a hash table of hash_mb MB, one thread and the
+ * start position. NULL if there isn't memory enough */
+ENGINE *EngineCreate (int hash_mb);
+
+void EngineDestroy (ENGINE * engine);
+
+/* Threads to search with, 1 by default */
+void EngineSetThreads (ENGINE * engine, int threads);
+
+/* Set up a position: what is in every square (0 = a8 ... 63 = h1) with the
+ * values of secondchess.c (PAWN = 0 ... KING = 5, EMPTY = 7; WHITE = 0,
+ * BLACK = 1), the side to move, the castle rights (1 = white short,
+ * 2 = white long, 4 = black short, 8 = black long) and the en passant
+ * square, -1 if none. Castle rights and an en passant square which don't
+ * fit the board are left out. Returns 0 if the position can't be played
+ * (not one king of each color, pawns in the first or last rank, the side
+ * which isn't to move in check), and then nothing is changed */
+int EngineSetPosition (ENGINE * engine, const int piece[64],
+		       const int color[64], int side, int castle_rights,
+		       int eps_square);
+
+/* The same from a FEN string, v.g.
+ * "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1". Returns 0 if
+ * the FEN isn't right, and then nothing is changed */
+int EngineSetFen (ENGINE * engine, const char *fen);
+
+/* Play a move in coordinate notation, v.g. "e2e4" or "a7a8q". Returns 0
+ * if the move isn't legal, and then nothing is changed */
+int EngineMakeMove (ENGINE * engine, const char *move);
+
+/* Search the current position to depth plies and write the best move in
+ * move (at least 6 chars), or "" if there isn't any. Returns the score in
+ * centipawns from the side to move's point of view */
+int EngineSearch (ENGINE * engine, int depth, char *move);
+
+/* Switch on (1) or off (0) a part of the search, to compare how it plays
+ * with and without it: "NullMove", "LMR", "Futility" or "ReverseFutility".
+ * All of them are on by default. Returns 0 if there's no such option */
+int EngineSetOption (ENGINE * engine, const char *name, int value);
+
+#endif